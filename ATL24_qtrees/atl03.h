@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdint>
+#include <hdf5.h>
+#include <string>
+#include <vector>
+#include "ATL24_qtrees/utils.h"
+
+namespace ATL24_qtrees
+{
+
+namespace atl03
+{
+
+// ATL03 ground tracks
+const std::vector<std::string> beam_names {
+    "gt1l", "gt1r",
+    "gt2l", "gt2r",
+    "gt3l", "gt3r"};
+
+namespace constants
+{
+    // Values greater than this are ATL03 fill values
+    constexpr double max_valid_value = 1e30;
+} // namespace constants
+
+namespace detail
+{
+
+template<typename F,typename... Args>
+auto call_hdf5 (F f, Args... args)
+{
+    using namespace std;
+
+    const auto result = invoke (f, args...);
+
+    if (result < 0)
+        throw runtime_error (string ("HDF5 error: ")
+            + string (__FILE__)
+            + ": "
+            + to_string (__LINE__));
+
+    return result;
+}
+
+// Closes an HDF5 identifier when it goes out of scope
+class handle
+{
+    public:
+    handle (const hid_t init_id, herr_t (*init_close) (hid_t))
+        : id (init_id)
+        , close (init_close)
+    {
+        if (id < 0)
+            throw std::runtime_error ("Could not open HDF5 object");
+    }
+    handle (const handle &) = delete;
+    handle &operator= (const handle &) = delete;
+    ~handle ()
+    {
+        close (id);
+    }
+    operator hid_t () const
+    {
+        return id;
+    }
+
+    private:
+    hid_t id;
+    herr_t (*close) (hid_t);
+};
+
+template<typename T> hid_t native_type ();
+template<> hid_t native_type<double> () { return H5T_NATIVE_DOUBLE; }
+template<> hid_t native_type<float> () { return H5T_NATIVE_FLOAT; }
+template<> hid_t native_type<int32_t> () { return H5T_NATIVE_INT32; }
+template<> hid_t native_type<int64_t> () { return H5T_NATIVE_INT64; }
+template<> hid_t native_type<uint32_t> () { return H5T_NATIVE_UINT32; }
+
+// Read a one-dimensional dataset, converting it to type 'T'
+template<typename T>
+std::vector<T> read_dataset (const hid_t file, const std::string &name)
+{
+    const handle d (H5Dopen2 (file, name.c_str (), H5P_DEFAULT), H5Dclose);
+    const handle s (H5Dget_space (d), H5Sclose);
+    const hssize_t n = call_hdf5 (H5Sget_simple_extent_npoints, hid_t (s));
+
+    std::vector<T> x (n);
+    if (n != 0)
+        call_hdf5 (H5Dread, hid_t (d), native_type<T> (), H5S_ALL, H5S_ALL, H5P_DEFAULT, x.data ());
+    return x;
+}
+
+// Write a one-dimensional dataset of type 'T'
+template<typename T>
+void write_dataset (const hid_t group, const std::string &name, const std::vector<T> &x)
+{
+    const hsize_t dims[1] = {x.size ()};
+    const handle s (H5Screate_simple (1, dims, nullptr), H5Sclose);
+    const handle d (H5Dcreate2 (group, name.c_str (), native_type<T> (), s,
+        H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Dclose);
+    if (!x.empty ())
+        call_hdf5 (H5Dwrite, hid_t (d), native_type<T> (), H5S_ALL, H5S_ALL, H5P_DEFAULT, x.data ());
+}
+
+inline bool exists (const hid_t file, const std::string &name)
+{
+    return call_hdf5 (H5Lexists, file, name.c_str (), H5P_DEFAULT) > 0;
+}
+
+} // namespace detail
+
+// Does the granule contain photons for 'beam'?
+inline bool has_beam (const hid_t file, const std::string &beam)
+{
+    return detail::exists (file, beam)
+        && detail::exists (file, beam + "/heights")
+        && detail::exists (file, beam + "/geolocation")
+        && detail::exists (file, beam + "/geophys_corr");
+}
+
+// Get the photons for one ground track
+//
+// Photon along-track distance is the segment's along-track distance plus
+// the photon's distance from the start of the segment. Elevation is the
+// photon height minus the segment's geoid height. Photons in segments
+// without a valid geoid are skipped. Each sample's 'h5_index' is the
+// photon's index into the beam's 'heights' datasets.
+inline std::vector<utils::sample> read_beam (const hid_t file, const std::string &beam)
+{
+    using namespace std;
+    using detail::read_dataset;
+
+    const auto h_ph = read_dataset<double> (file, beam + "/heights/h_ph");
+    const auto dist_ph_along = read_dataset<double> (file, beam + "/heights/dist_ph_along");
+    const auto segment_dist_x = read_dataset<double> (file, beam + "/geolocation/segment_dist_x");
+    const auto segment_ph_cnt = read_dataset<int64_t> (file, beam + "/geolocation/segment_ph_cnt");
+    const auto ph_index_beg = read_dataset<int64_t> (file, beam + "/geolocation/ph_index_beg");
+    const auto geoid = read_dataset<double> (file, beam + "/geophys_corr/geoid");
+
+    if (h_ph.size () != dist_ph_along.size ())
+        throw runtime_error ("Photon dataset sizes do not match in " + beam);
+    if (segment_dist_x.size () != segment_ph_cnt.size ()
+        || segment_dist_x.size () != ph_index_beg.size ()
+        || segment_dist_x.size () != geoid.size ())
+        throw runtime_error ("Segment dataset sizes do not match in " + beam);
+
+    vector<utils::sample> samples;
+    samples.reserve (h_ph.size ());
+
+    for (size_t i = 0; i < segment_dist_x.size (); ++i)
+    {
+        // Skip empty segments
+        if (segment_ph_cnt[i] <= 0 || ph_index_beg[i] <= 0)
+            continue;
+
+        // Skip segments without a geoid
+        if (!(std::fabs (geoid[i]) < constants::max_valid_value))
+            continue;
+
+        // 'ph_index_beg' is one-based
+        const size_t first = ph_index_beg[i] - 1;
+        const size_t last = first + segment_ph_cnt[i];
+
+        if (last > h_ph.size ())
+            throw runtime_error ("Segment photon index is out of range in " + beam);
+
+        for (size_t j = first; j < last; ++j)
+        {
+            utils::sample s {};
+            s.h5_index = j;
+            s.x = segment_dist_x[i] + dist_ph_along[j];
+            s.z = h_ph[j] - geoid[i];
+            samples.push_back (s);
+        }
+    }
+
+    return samples;
+}
+
+// Write the classified photons for one ground track into 'file'
+template<typename T>
+void write_beam (const hid_t file, const std::string &beam, const T &samples)
+{
+    using namespace std;
+    using detail::handle;
+    using detail::write_dataset;
+
+    vector<int64_t> index_ph (samples.size ());
+    vector<uint32_t> prediction (samples.size ());
+    vector<double> sea_surface_h (samples.size ());
+    vector<double> bathy_h (samples.size ());
+
+    for (size_t i = 0; i < samples.size (); ++i)
+    {
+        index_ph[i] = samples[i].h5_index;
+        prediction[i] = samples[i].prediction;
+        sea_surface_h[i] = samples[i].surface_elevation;
+        bathy_h[i] = samples[i].bathy_elevation;
+    }
+
+    const handle g (H5Gcreate2 (file, beam.c_str (), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Gclose);
+    write_dataset (g, "index_ph", index_ph);
+    write_dataset (g, "prediction", prediction);
+    write_dataset (g, "sea_surface_h", sea_surface_h);
+    write_dataset (g, "bathy_h", bathy_h);
+}
+
+} // namespace atl03
+
+} // namespace ATL24_qtrees
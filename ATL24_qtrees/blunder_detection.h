@@ -283,22 +283,22 @@ T blunder_detection (T p, const U &params)
         return p;
 
     // Surface photons must be near sea level
-    p = detail::surface_elevation_check (p,
+    p = detail::surface_elevation_check (std::move (p),
         params.surface_min_elevation,
         params.surface_max_elevation);
 
     // Bathy photons can't be too deep
-    p = detail::bathy_elevation_check (p,
+    p = detail::bathy_elevation_check (std::move (p),
         params.bathy_min_elevation);
 
     // Bathy photons can't be above the sea surface
-    p = detail::relative_depth_check (p, params.water_column_width);
+    p = detail::relative_depth_check (std::move (p), params.water_column_width);
 
     // Sea surface photons must all be near the elevation estimate
-    p = detail::surface_range_check (p, params.surface_range);
+    p = detail::surface_range_check (std::move (p), params.surface_range);
 
     // Bathy photons must all be near the elevation estimate
-    p = detail::bathy_range_check (p, params.bathy_range);
+    p = detail::bathy_range_check (std::move (p), params.bathy_range);
 
     return p;
 }
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include "ATL24_qtrees/compression.h"
+#include "ATL24_qtrees/dataframe.h"
+
+// Binary columnar dataframe format
+//
+// All values are stored in host (little-endian) byte order.
+//
+//     magic        8 bytes, "ATL24QTC"
+//     version      uint32
+//     reserved     uint32
+//     columns      uint64
+//     rows         uint64
+//
+// Then, for each column:
+//
+//     type         uint32, a 'column_type'
+//     name size    uint32
+//     name         'name size' bytes
+//
+// Then, for each column, the column's values, starting on an
+// 'alignment' byte boundary.
+
+namespace ATL24_qtrees
+{
+
+namespace columnar
+{
+
+constexpr char magic[8] = {'A', 'T', 'L', '2', '4', 'Q', 'T', 'C'};
+constexpr uint32_t version = 1;
+constexpr size_t alignment = 64;
+
+enum column_type : uint32_t
+{
+    float64_type = 1,
+    float32_type = 2,
+    int64_type = 3,
+    uint8_type = 4
+};
+
+// A dataframe whose columns point into a mapped file
+struct mapped_dataframe : dataframe::basic_dataframe<dataframe::column_view>
+{
+    // Keeps the columns' memory alive
+    std::shared_ptr<const dataframe::mapped_file> file;
+};
+
+namespace detail
+{
+
+inline size_t align (const size_t n)
+{
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+template<typename T>
+void write_value (std::ostream &os, const T &x)
+{
+    os.write (reinterpret_cast<const char *> (&x), sizeof (T));
+}
+
+template<typename T>
+T read_value (const char *&p, const char *end)
+{
+    T x;
+    if (end - p < static_cast<ptrdiff_t> (sizeof (T)))
+        throw std::runtime_error ("Columnar dataframe header is truncated");
+    memcpy (&x, p, sizeof (T));
+    p += sizeof (T);
+    return x;
+}
+
+template<typename T> uint32_t get_type ();
+template<> uint32_t get_type<double> () { return float64_type; }
+template<> uint32_t get_type<float> () { return float32_type; }
+template<> uint32_t get_type<int64_t> () { return int64_type; }
+template<> uint32_t get_type<uint8_t> () { return uint8_type; }
+
+// Get a view of 'n' values of type 'T' at 'p'
+template<typename T>
+dataframe::column_view get_column (const char *p, const size_t n)
+{
+    return dataframe::column_view (std::span<const T> (reinterpret_cast<const T *> (p), n));
+}
+
+inline void write_padding (std::ostream &os, const size_t offset)
+{
+    const char zeros[alignment] {};
+    os.write (zeros, align (offset) - offset);
+}
+
+} // namespace detail
+
+// Does the buffer contain a columnar dataframe?
+inline bool is_columnar (const char *p, const size_t n)
+{
+    return n >= sizeof (magic) && memcmp (p, magic, sizeof (magic)) == 0;
+}
+
+inline bool is_columnar (const dataframe::mapped_file &f)
+{
+    return is_columnar (f.data (), f.size ());
+}
+
+template<typename T>
+std::ostream &write (std::ostream &os, const T &df)
+{
+    using namespace std;
+    using detail::write_value;
+
+    assert (df.is_valid ());
+
+    const uint64_t ncols = df.columns.size ();
+    const uint64_t nrows = df.rows ();
+
+    // Header
+    os.write (magic, sizeof (magic));
+    write_value (os, version);
+    write_value (os, uint32_t (0));
+    write_value (os, ncols);
+    write_value (os, nrows);
+    size_t offset = sizeof (magic) + 2 * sizeof (uint32_t) + 2 * sizeof (uint64_t);
+
+    // Column descriptions
+    for (size_t i = 0; i < ncols; ++i)
+    {
+        const auto &h = df.headers[i];
+        const uint32_t type = dataframe::visit_column (df.columns[i], [] (const auto &c)
+            { return detail::get_type<typename std::decay_t<decltype (c)>::value_type> (); });
+        write_value (os, type);
+        write_value (os, uint32_t (h.size ()));
+        os.write (h.data (), h.size ());
+        offset += 2 * sizeof (uint32_t) + h.size ();
+    }
+
+    // Column values
+    for (const auto &c : df.columns)
+    {
+        detail::write_padding (os, offset);
+        offset = detail::align (offset);
+        const size_t bytes = dataframe::visit_column (c, [&] (const auto &x)
+        {
+            const size_t n = nrows * sizeof (x[0]);
+            os.write (reinterpret_cast<const char *> (x.data ()), n);
+            return n;
+        });
+        offset += bytes;
+    }
+
+    return os;
+}
+
+// Get a dataframe that references the columns stored in 'f'
+inline mapped_dataframe read (const std::shared_ptr<const dataframe::mapped_file> &f)
+{
+    using namespace std;
+    using detail::read_value;
+
+    const char *begin = f->data ();
+    const char *end = begin + f->size ();
+    const char *p = begin;
+
+    if (!is_columnar (begin, f->size ()))
+        throw runtime_error ("Not a columnar dataframe");
+    p += sizeof (magic);
+
+    if (read_value<uint32_t> (p, end) != version)
+        throw runtime_error ("Unsupported columnar dataframe version");
+    read_value<uint32_t> (p, end);
+    const uint64_t ncols = read_value<uint64_t> (p, end);
+    const uint64_t nrows = read_value<uint64_t> (p, end);
+
+    mapped_dataframe df;
+    df.file = f;
+
+    // Column descriptions
+    vector<uint32_t> types;
+    for (size_t i = 0; i < ncols; ++i)
+    {
+        const uint32_t type = read_value<uint32_t> (p, end);
+        if (type < float64_type || type > uint8_type)
+            throw runtime_error ("Unsupported columnar dataframe column type");
+        types.push_back (type);
+        const uint32_t n = read_value<uint32_t> (p, end);
+        if (static_cast<size_t> (end - p) < n)
+            throw runtime_error ("Columnar dataframe header is truncated");
+        df.headers.emplace_back (p, n);
+        p += n;
+    }
+
+    // Column values
+    for (size_t i = 0; i < ncols; ++i)
+    {
+        const size_t size = types[i] == float64_type ? sizeof (double)
+            : types[i] == float32_type ? sizeof (float)
+            : types[i] == int64_type ? sizeof (int64_t)
+            : sizeof (uint8_t);
+        p = begin + detail::align (p - begin);
+        if (p > end || static_cast<uint64_t> (end - p) / size < nrows)
+            throw runtime_error ("Columnar dataframe is truncated");
+        switch (types[i])
+        {
+            case float64_type: df.columns.push_back (detail::get_column<double> (p, nrows)); break;
+            case float32_type: df.columns.push_back (detail::get_column<float> (p, nrows)); break;
+            case int64_type: df.columns.push_back (detail::get_column<int64_t> (p, nrows)); break;
+            case uint8_type: df.columns.push_back (detail::get_column<uint8_t> (p, nrows)); break;
+        }
+        p += nrows * size;
+    }
+
+    assert (df.is_valid ());
+    return df;
+}
+
+inline mapped_dataframe read (const std::string &fn)
+{
+    return read (std::make_shared<const dataframe::mapped_file> (fn));
+}
+
+// Call 'f' with the dataframe stored in 'file'
+//
+// Columnar files are used in place, with the column types they were
+// written with. CSV files are parsed, only keeping the columns in
+// 'columns', unless 'other_columns' is true, in which case the other
+// columns are read as float64. Either can be gzip or zstd compressed.
+template<typename F>
+auto visit (const std::shared_ptr<const dataframe::mapped_file> &file,
+    F f,
+    const std::vector<dataframe::column_spec> &columns,
+    const bool other_columns = false)
+{
+    if (is_columnar (*file))
+        return f (read (file));
+
+    const char *begin = file->data ();
+    const char *end = begin + file->size ();
+
+    // Compressed columnar files have to be decompressed before they can be
+    // used in place. Compressed CSV files are decompressed while they are
+    // being parsed.
+    if (compression::starts_with (begin, end, magic, sizeof (magic)))
+    {
+        auto buffer = compression::decompress (begin, end);
+        return f (read (std::make_shared<const dataframe::mapped_file> (std::move (buffer))));
+    }
+
+    return f (dataframe::read_typed (begin, end, columns, other_columns));
+}
+
+// Call 'f' with all of the columns of the dataframe stored in 'file'
+template<typename F>
+auto visit (const std::shared_ptr<const dataframe::mapped_file> &file, F f)
+{
+    return visit (file, f, {}, true);
+}
+
+} // namespace columnar
+
+} // namespace ATL24_qtrees
@@ -0,0 +1,486 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <omp.h>
+#include <zlib.h>
+#include <zstd.h>
+
+namespace ATL24_qtrees
+{
+
+namespace compression
+{
+
+enum class format
+{
+    none,
+    gzip,
+    zstd
+};
+
+// Get the compression format from its name
+inline format get_format (const std::string &name)
+{
+    if (name.empty () || name == "none")
+        return format::none;
+    if (name == "gzip")
+        return format::gzip;
+    if (name == "zstd")
+        return format::zstd;
+    throw std::runtime_error ("Unknown compression format: " + name);
+}
+
+// Get the compression format from the buffer's magic number
+inline format detect (const char *p, const size_t n)
+{
+    const unsigned char gzip_magic[] = {0x1f, 0x8b};
+    const unsigned char zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+    if (n >= sizeof (gzip_magic) && memcmp (p, gzip_magic, sizeof (gzip_magic)) == 0)
+        return format::gzip;
+    if (n >= sizeof (zstd_magic) && memcmp (p, zstd_magic, sizeof (zstd_magic)) == 0)
+        return format::zstd;
+    return format::none;
+}
+
+// Incrementally decompress a gzip or zstd compressed buffer
+class decompressor
+{
+    public:
+    decompressor (const char *init_begin, const char *init_end)
+        : fmt (detect (init_begin, init_end - init_begin))
+        , p (init_begin)
+        , end (init_end)
+    {
+        switch (fmt)
+        {
+            default:
+            throw std::runtime_error ("Buffer is not compressed");
+            case format::gzip:
+            {
+                zs = z_stream {};
+                // Automatic gzip header detection
+                if (inflateInit2 (&zs, 16 + MAX_WBITS) != Z_OK)
+                    throw std::runtime_error ("Could not initialize gzip decompression");
+            }
+            break;
+            case format::zstd:
+            {
+                zds = ZSTD_createDStream ();
+                if (zds == nullptr)
+                    throw std::runtime_error ("Could not initialize zstd decompression");
+            }
+            break;
+        }
+    }
+    decompressor (const decompressor &) = delete;
+    decompressor &operator= (const decompressor &) = delete;
+    ~decompressor ()
+    {
+        if (fmt == format::gzip)
+            inflateEnd (&zs);
+        else
+            ZSTD_freeDStream (zds);
+    }
+    // Decompress up to 'n' bytes into 'out'
+    //
+    // Returns the number of bytes decompressed, which is only less than
+    // 'n' at the end of the buffer.
+    size_t read (char *out, const size_t n)
+    {
+        size_t total = 0;
+        while (total < n && !done)
+        {
+            total += (fmt == format::gzip)
+                ? inflate_some (out + total, n - total)
+                : decompress_some (out + total, n - total);
+        }
+        return total;
+    }
+
+    private:
+    format fmt;
+    const char *p;
+    const char *end;
+    z_stream zs;
+    ZSTD_DStream *zds = nullptr;
+    bool done = false;
+
+    size_t inflate_some (char *out, const size_t n)
+    {
+        // zlib counts in 'uInt's
+        const size_t max_size = std::numeric_limits<uInt>::max ();
+
+        if (zs.avail_in == 0)
+        {
+            zs.next_in = reinterpret_cast<Bytef *> (const_cast<char *> (p));
+            zs.avail_in = std::min<size_t> (end - p, max_size);
+            p += zs.avail_in;
+        }
+        zs.next_out = reinterpret_cast<Bytef *> (out);
+        zs.avail_out = std::min (n, max_size);
+        const size_t avail_out = zs.avail_out;
+
+        const int ret = inflate (&zs, Z_NO_FLUSH);
+
+        if (ret == Z_STREAM_END)
+        {
+            // Concatenated gzip files are decompressed as one
+            if (zs.avail_in == 0 && p == end)
+                done = true;
+            else if (inflateReset (&zs) != Z_OK)
+                throw std::runtime_error ("Could not reset gzip decompression");
+        }
+        else if (ret == Z_BUF_ERROR && zs.avail_in == 0 && p == end)
+            throw std::runtime_error ("Compressed gzip data is truncated");
+        else if (ret != Z_OK && ret != Z_BUF_ERROR)
+            throw std::runtime_error ("gzip decompression error");
+
+        return avail_out - zs.avail_out;
+    }
+    size_t decompress_some (char *out, const size_t n)
+    {
+        ZSTD_inBuffer in {p, static_cast<size_t> (end - p), 0};
+        ZSTD_outBuffer o {out, n, 0};
+
+        const size_t ret = ZSTD_decompressStream (zds, &o, &in);
+        if (ZSTD_isError (ret))
+            throw std::runtime_error (std::string ("zstd decompression error: ") + ZSTD_getErrorName (ret));
+
+        p += in.pos;
+
+        // All input has been consumed and all output flushed
+        if (p == end && o.pos < o.size)
+        {
+            if (ret != 0)
+                throw std::runtime_error ("Compressed zstd data is truncated");
+            done = true;
+        }
+
+        return o.pos;
+    }
+};
+
+// Decompress a buffer on a separate thread, one block at a time
+//
+// The caller can process each block while the following blocks are being
+// decompressed.
+class threaded_decompressor
+{
+    public:
+    threaded_decompressor (const char *begin,
+        const char *end,
+        const size_t init_block_size = 4 << 20,
+        const size_t init_max_blocks = 4)
+        : d (begin, end)
+        , block_size (init_block_size)
+        , max_blocks (init_max_blocks)
+        , thread ([this] { run (); })
+    {
+    }
+    threaded_decompressor (const threaded_decompressor &) = delete;
+    threaded_decompressor &operator= (const threaded_decompressor &) = delete;
+    ~threaded_decompressor ()
+    {
+        {
+            std::lock_guard<std::mutex> lock (m);
+            stopped = true;
+        }
+        cv.notify_all ();
+        thread.join ();
+    }
+    // Get the next block
+    //
+    // Returns false when there are no more blocks.
+    bool next (std::vector<char> &block)
+    {
+        std::unique_lock<std::mutex> lock (m);
+        cv.wait (lock, [this] { return !blocks.empty () || finished; });
+
+        if (!blocks.empty ())
+        {
+            block = std::move (blocks.front ());
+            blocks.pop_front ();
+            lock.unlock ();
+            cv.notify_all ();
+            return true;
+        }
+
+        // Pass errors on to the caller
+        if (error)
+            std::rethrow_exception (error);
+
+        return false;
+    }
+
+    private:
+    decompressor d;
+    const size_t block_size;
+    const size_t max_blocks;
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<std::vector<char>> blocks;
+    bool finished = false;
+    bool stopped = false;
+    std::exception_ptr error;
+    std::thread thread;
+
+    void run ()
+    {
+        try
+        {
+            for (;;)
+            {
+                std::vector<char> block (block_size);
+                block.resize (d.read (block.data (), block.size ()));
+
+                std::unique_lock<std::mutex> lock (m);
+                cv.wait (lock, [this] { return blocks.size () < max_blocks || stopped; });
+
+                if (stopped)
+                    return;
+
+                if (block.empty ())
+                {
+                    finished = true;
+                    lock.unlock ();
+                    cv.notify_all ();
+                    return;
+                }
+
+                blocks.push_back (std::move (block));
+                lock.unlock ();
+                cv.notify_all ();
+            }
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> lock (m);
+                error = std::current_exception ();
+                finished = true;
+            }
+            cv.notify_all ();
+        }
+    }
+};
+
+// Is the buffer compressed data that starts with 'magic'?
+inline bool starts_with (const char *begin, const char *end, const char *magic, const size_t n)
+{
+    if (detect (begin, end - begin) == format::none)
+        return false;
+
+    decompressor d (begin, end);
+    std::vector<char> tmp (n);
+    return d.read (tmp.data (), n) == n && memcmp (tmp.data (), magic, n) == 0;
+}
+
+// Decompress the entire buffer
+inline std::vector<char> decompress (const char *begin, const char *end)
+{
+    std::vector<char> buffer;
+    threaded_decompressor d (begin, end);
+    for (std::vector<char> block; d.next (block); )
+        buffer.insert (buffer.end (), block.begin (), block.end ());
+    return buffer;
+}
+
+// A stream buffer that compresses its output and writes it to another
+// stream
+//
+// Call finish () to write the end of the compressed data. Otherwise, it
+// gets written when the stream buffer is destroyed.
+class compressing_streambuf : public std::streambuf
+{
+    public:
+    compressing_streambuf (std::ostream &init_os, const format init_fmt)
+        : os (init_os)
+        , fmt (init_fmt)
+        , in (1 << 20)
+        , out (1 << 20)
+    {
+        switch (fmt)
+        {
+            default:
+            throw std::runtime_error ("Invalid compression format");
+            case format::gzip:
+            {
+                zs = z_stream {};
+                if (deflateInit2 (&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                    throw std::runtime_error ("Could not initialize gzip compression");
+            }
+            break;
+            case format::zstd:
+            {
+                cctx = ZSTD_createCCtx ();
+                if (cctx == nullptr)
+                    throw std::runtime_error ("Could not initialize zstd compression");
+                // Compress on several threads if the library supports it
+                ZSTD_CCtx_setParameter (cctx, ZSTD_c_nbWorkers, omp_get_max_threads ());
+            }
+            break;
+        }
+        setp (in.data (), in.data () + in.size ());
+    }
+    compressing_streambuf (const compressing_streambuf &) = delete;
+    compressing_streambuf &operator= (const compressing_streambuf &) = delete;
+    ~compressing_streambuf ()
+    {
+        try
+        {
+            finish ();
+        }
+        catch (...)
+        {
+        }
+
+        if (fmt == format::gzip)
+            deflateEnd (&zs);
+        else
+            ZSTD_freeCCtx (cctx);
+    }
+    void finish ()
+    {
+        if (finished)
+            return;
+        compress (pbase (), pptr () - pbase (), true);
+        setp (in.data (), in.data () + in.size ());
+        finished = true;
+        os.flush ();
+    }
+
+    protected:
+    int_type overflow (int_type c) override
+    {
+        compress (pbase (), pptr () - pbase (), false);
+        setp (in.data (), in.data () + in.size ());
+        if (!traits_type::eq_int_type (c, traits_type::eof ()))
+        {
+            *pptr () = traits_type::to_char_type (c);
+            pbump (1);
+        }
+        return traits_type::not_eof (c);
+    }
+    std::streamsize xsputn (const char *s, std::streamsize n) override
+    {
+        // Compress large writes without copying them
+        if (static_cast<size_t> (n) < in.size ())
+            return std::streambuf::xsputn (s, n);
+        compress (pbase (), pptr () - pbase (), false);
+        setp (in.data (), in.data () + in.size ());
+        compress (s, n, false);
+        return n;
+    }
+
+    private:
+    std::ostream &os;
+    format fmt;
+    std::vector<char> in;
+    std::vector<char> out;
+    z_stream zs;
+    ZSTD_CCtx *cctx = nullptr;
+    bool finished = false;
+
+    void compress (const char *p, size_t n, const bool last)
+    {
+        if (finished)
+            throw std::runtime_error ("Can't write to a finished compressed stream");
+        if (fmt == format::gzip)
+            deflate_some (p, n, last);
+        else
+            compress_some (p, n, last);
+        if (!os)
+            throw std::runtime_error ("Could not write compressed data");
+    }
+    void deflate_some (const char *p, size_t n, const bool last)
+    {
+        // zlib counts in 'uInt's
+        const size_t max_size = std::numeric_limits<uInt>::max ();
+
+        for (;;)
+        {
+            const size_t len = std::min (n, max_size);
+            zs.next_in = reinterpret_cast<Bytef *> (const_cast<char *> (p));
+            zs.avail_in = len;
+            p += len;
+            n -= len;
+            const int flush = (last && n == 0) ? Z_FINISH : Z_NO_FLUSH;
+
+            int ret;
+            do
+            {
+                zs.next_out = reinterpret_cast<Bytef *> (out.data ());
+                zs.avail_out = out.size ();
+                ret = deflate (&zs, flush);
+                if (ret == Z_STREAM_ERROR)
+                    throw std::runtime_error ("gzip compression error");
+                os.write (out.data (), out.size () - zs.avail_out);
+            }
+            while (zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+
+            if (n == 0)
+                break;
+        }
+    }
+    void compress_some (const char *p, const size_t n, const bool last)
+    {
+        ZSTD_inBuffer i {p, n, 0};
+        const auto mode = last ? ZSTD_e_end : ZSTD_e_continue;
+
+        for (;;)
+        {
+            ZSTD_outBuffer o {out.data (), out.size (), 0};
+            const size_t ret = ZSTD_compressStream2 (cctx, &o, &i, mode);
+            if (ZSTD_isError (ret))
+                throw std::runtime_error (std::string ("zstd compression error: ") + ZSTD_getErrorName (ret));
+            os.write (out.data (), o.pos);
+
+            // Done when all input is consumed, and, at the end, flushed
+            if (last ? ret == 0 : i.pos == i.size)
+                break;
+        }
+    }
+};
+
+// An output stream that compresses everything written to it and writes
+// it to 'os', or that writes directly to 'os' if the format is
+// 'format::none'
+class ostream : public std::ostream
+{
+    public:
+    ostream (std::ostream &os, const format fmt)
+        : std::ostream (os.rdbuf ())
+    {
+        if (fmt == format::none)
+            return;
+        buf = std::make_unique<compressing_streambuf> (os, fmt);
+        rdbuf (buf.get ());
+    }
+    // Write the end of the compressed data
+    void finish ()
+    {
+        flush ();
+        if (buf)
+            buf->finish ();
+    }
+
+    private:
+    std::unique_ptr<compressing_streambuf> buf;
+};
+
+} // namespace compression
+
+} // namespace ATL24_qtrees
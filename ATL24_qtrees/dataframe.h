@@ -2,12 +2,31 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <span>
 #include <sstream>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <variant>
 #include <vector>
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ATL24_qtrees/compression.h"
 
 namespace ATL24_qtrees
 {
@@ -15,10 +34,262 @@ namespace ATL24_qtrees
 namespace dataframe
 {
 
-struct dataframe
+// The types of values that a column can hold
+enum class column_type
 {
-    std::vector<std::string> headers;
-    std::vector<std::vector<double>> columns;
+    float64,
+    float32,
+    int64,
+    uint8
+};
+
+namespace detail
+{
+
+// Convert a parsed value to a column's type
+//
+// Integer columns can't hold values that are not finite or that are
+// outside of their range, so those values are rejected.
+template<typename T>
+T convert (const double x)
+{
+    if constexpr (std::is_integral_v<T>)
+    {
+        // The range of values that truncate to a value of type 'T'
+        const double t = std::trunc (x);
+        const double hi = std::ldexp (1.0, std::numeric_limits<T>::digits);
+        const double lo = std::is_signed_v<T> ? -hi : 0.0;
+        if (!(t >= lo && t < hi))
+            throw std::runtime_error (std::string ("Value is out of range for an integer column: ")
+                + std::to_string (x));
+    }
+    return static_cast<T> (x);
+}
+
+} // namespace detail
+
+template<typename T> using vector_column = std::vector<T>;
+template<typename T> using span_column = std::span<const T>;
+
+// A column of values of any of the column types
+//
+// 'S<T>' holds the values. It is a vector for columns that own their
+// values and a span for columns that reference values stored elsewhere.
+// Values are stored as their own type, and 'visit ()' passes them on
+// without converting them.
+template<template<typename> typename S>
+class basic_column
+{
+    public:
+    basic_column (const column_type t = column_type::float64)
+    {
+        switch (t)
+        {
+            default:
+            assert (0);
+            break;
+            case column_type::float64: values = S<double> (); break;
+            case column_type::float32: values = S<float> (); break;
+            case column_type::int64: values = S<int64_t> (); break;
+            case column_type::uint8: values = S<uint8_t> (); break;
+        }
+    }
+    template<typename T>
+    basic_column (S<T> x)
+        : values (std::move (x))
+    {
+    }
+    column_type type () const
+    {
+        return static_cast<column_type> (values.index ());
+    }
+    size_t size () const
+    {
+        return visit ([] (const auto &x) { return x.size (); });
+    }
+    void resize (const size_t n)
+    {
+        visit ([&] (auto &x) { x.resize (n); });
+    }
+    // Get value 'i' converted to a double
+    double operator[] (const size_t i) const
+    {
+        return visit ([&] (const auto &x) { return static_cast<double> (x[i]); });
+    }
+    // Set value 'i', converting it to the column's type
+    void set (const size_t i, const double x)
+    {
+        visit ([&] (auto &y) { y[i] = detail::convert<typename std::decay_t<decltype (y)>::value_type> (x); });
+    }
+    // Get the values, which must be of type 'T'
+    template<typename T>
+    const S<T> &get () const
+    {
+        return std::get<S<T>> (values);
+    }
+    template<typename T>
+    S<T> &get ()
+    {
+        return std::get<S<T>> (values);
+    }
+    // Call 'f' with the values
+    template<typename F>
+    auto visit (F f) const
+    {
+        return std::visit (f, values);
+    }
+    template<typename F>
+    auto visit (F f)
+    {
+        return std::visit (f, values);
+    }
+
+    private:
+    // Must be in the same order as 'column_type'
+    std::variant<S<double>, S<float>, S<int64_t>, S<uint8_t>> values;
+};
+
+using column = basic_column<vector_column>;
+using column_view = basic_column<span_column>;
+
+// Call 'f' with the column's values in their own type
+template<typename T,typename F>
+auto visit_column (const std::vector<T> &c, F f)
+{
+    return f (c);
+}
+
+template<typename T,typename F>
+auto visit_column (const std::span<T> &c, F f)
+{
+    return f (c);
+}
+
+template<template<typename> typename S,typename F>
+auto visit_column (const basic_column<S> &c, F f)
+{
+    return c.visit (f);
+}
+
+// Get a view of a column's values
+template<typename C>
+column_view view (const C &c)
+{
+    return visit_column (c, [] (const auto &x)
+    {
+        using T = typename std::decay_t<decltype (x)>::value_type;
+        return column_view (span_column<std::remove_const_t<T>> (x.data (), x.size ()));
+    });
+}
+
+namespace detail
+{
+
+template<typename T>
+void push_back (std::vector<T> &c, const std::vector<T> &other, const size_t n)
+{
+    c.push_back (other[n]);
+}
+
+template<typename T>
+void append (std::vector<T> &c, const std::vector<T> &other)
+{
+    c.insert (c.end (), other.begin (), other.end ());
+}
+
+inline void push_back (column &c, const column &other, const size_t n)
+{
+    if (c.type () != other.type ())
+        throw std::runtime_error ("The column types do not match");
+    c.visit ([&] (auto &x) { x.push_back (other.get<typename std::decay_t<decltype (x)>::value_type> ()[n]); });
+}
+
+inline void append (column &c, const column &other)
+{
+    if (c.type () != other.type ())
+        throw std::runtime_error ("The column types do not match");
+    c.visit ([&] (auto &x)
+    {
+        const auto &y = other.get<typename std::decay_t<decltype (x)>::value_type> ();
+        x.insert (x.end (), y.begin (), y.end ());
+    });
+}
+
+} // namespace detail
+
+// Column names, with an index for looking up a column by its name
+//
+// If a name appears more than once, lookups find the first column with
+// that name.
+class header_list
+{
+    public:
+    header_list () = default;
+    header_list (std::initializer_list<std::string> init)
+    {
+        for (const auto &h : init)
+            push_back (h);
+    }
+    header_list (const std::vector<std::string> &init)
+    {
+        for (const auto &h : init)
+            push_back (h);
+    }
+    void push_back (const std::string &h)
+    {
+        index.emplace (h, names.size ());
+        names.push_back (h);
+    }
+    template<typename... Args>
+    void emplace_back (Args&&... args)
+    {
+        push_back (std::string (std::forward<Args> (args)...));
+    }
+    void clear ()
+    {
+        names.clear ();
+        index.clear ();
+    }
+    size_t size () const { return names.size (); }
+    bool empty () const { return names.empty (); }
+    const std::string &operator[] (const size_t i) const { return names[i]; }
+    auto begin () const { return names.begin (); }
+    auto end () const { return names.end (); }
+    // Get the position of the column named 'h', or 'size ()' if there
+    // isn't one
+    size_t find (const std::string &h) const
+    {
+        const auto it = index.find (h);
+        return it == index.end () ? names.size () : it->second;
+    }
+    bool operator== (const header_list &other) const
+    {
+        return names == other.names;
+    }
+
+    private:
+    std::vector<std::string> names;
+    std::unordered_map<std::string, size_t> index;
+};
+
+// The position of a dataframe column
+//
+// Look up a column's handle once, outside of a loop, instead of looking
+// up the column by name inside the loop.
+struct column_handle
+{
+    size_t index;
+};
+
+// A set of named columns
+//
+// 'C' is the column type. It is usually a vector, but it can also be a
+// view of columns that are stored elsewhere.
+template<typename C>
+struct basic_dataframe
+{
+    header_list headers;
+    std::vector<C> columns;
     bool is_valid () const
     {
         // Number of headers match number of columns
@@ -38,22 +309,34 @@ struct dataframe
     // Check if a column name exists
     bool has_column (const std::string &name) const
     {
-        using namespace std;
-        const auto it = find (headers.begin (), headers.end (), name);
-        return !(it == headers.end ());
+        return headers.find (name) != headers.size ();
+    }
+    // Get the handle of the column with header named 'h'
+    column_handle get_handle (const std::string &h) const
+    {
+        const size_t index = headers.find (h);
+        if (index == headers.size ())
+            throw std::runtime_error (std::string ("Can't find dataframe column: ") + h);
+        return column_handle {index};
     }
     // Access the column with header named 'h'
-    const std::vector<double> &operator[] (const std::string &h) const
+    const C &operator[] (const std::string &h) const
     {
-        using namespace std;
-        const auto it = find (headers.begin (), headers.end (), h);
-        if (it == headers.end ())
-            throw runtime_error (string ("Can't find dataframe column: ") + h);
-        const size_t index = it - headers.begin ();
-        return columns[index];
+        return columns[get_handle (h).index];
+    }
+    // Access a column by its handle
+    const C &operator[] (const column_handle h) const
+    {
+        assert (h.index < columns.size ());
+        return columns[h.index];
+    }
+    C &operator[] (const column_handle h)
+    {
+        assert (h.index < columns.size ());
+        return columns[h.index];
     }
     // Add row 'n' from the dataframe 'df' into this dataframe
-    void add_row (const dataframe &df, const size_t n)
+    void add_row (const basic_dataframe &df, const size_t n)
     {
         // Check invariants
         assert (df.is_valid ());
@@ -64,14 +347,14 @@ struct dataframe
         {
             assert (i < columns.size ());
             assert (n < df.columns[i].size ());
-            columns[i].push_back (df.columns[i][n]);
+            detail::push_back (columns[i], df.columns[i], n);
         }
 
         // Check invariants
         assert (is_valid ());
     }
     // Append all rows from 'df' to this dataframe
-    void append (const dataframe &df)
+    void append (const basic_dataframe &df)
     {
         // Check invariants
         assert (df.is_valid ());
@@ -87,128 +370,754 @@ struct dataframe
         assert (df.columns.size () == columns.size ());
 
         for (size_t i = 0; i < columns.size (); ++i)
-            columns[i].insert (columns[i].end (),
-                df.columns[i].begin (),
-                df.columns[i].end ());
+            detail::append (columns[i], df.columns[i]);
 
         // Check invariants
         assert (is_valid ());
     }
 };
 
-dataframe read (std::istream &is)
+using dataframe = basic_dataframe<std::vector<double>>;
+using typed_dataframe = basic_dataframe<column>;
+
+// Read-only view of a file's contents
+//
+// Regular files are memory-mapped. Files that can't be mapped, like
+// pipes, are read into a buffer instead.
+class mapped_file
 {
-    using namespace std;
+    public:
+    explicit mapped_file (const std::string &fn)
+    {
+        const int fd = ::open (fn.c_str (), O_RDONLY);
+        if (fd == -1)
+            throw std::runtime_error ("Could not open file for reading");
+        try
+        {
+            map (fd);
+        }
+        catch (...)
+        {
+            ::close (fd);
+            throw;
+        }
+        ::close (fd);
+    }
+    explicit mapped_file (const int fd)
+    {
+        map (fd);
+    }
+    // Take ownership of a buffer that is already in memory
+    explicit mapped_file (std::vector<char> &&init_buffer)
+        : buffer (std::move (init_buffer))
+    {
+    }
+    mapped_file (const mapped_file &) = delete;
+    mapped_file &operator= (const mapped_file &) = delete;
+    ~mapped_file ()
+    {
+        if (mapping != MAP_FAILED)
+            ::munmap (mapping, mapping_size);
+    }
+    const char *data () const
+    {
+        return mapping != MAP_FAILED
+            ? static_cast<const char *> (mapping)
+            : buffer.data ();
+    }
+    size_t size () const
+    {
+        return mapping != MAP_FAILED ? mapping_size : buffer.size ();
+    }
+    bool is_mapped () const
+    {
+        return mapping != MAP_FAILED;
+    }
 
-    // Create the dataframe
-    dataframe df;
+    private:
+    void *mapping = MAP_FAILED;
+    size_t mapping_size = 0;
+    std::vector<char> buffer;
 
-    // Read the headers
-    string line;
+    void map (const int fd)
+    {
+        struct stat sb;
+        if (::fstat (fd, &sb) == -1)
+            throw std::runtime_error ("Could not stat file");
 
-    if (!getline (is, line))
-        return df;
+        // Map regular files
+        if (S_ISREG (sb.st_mode) && sb.st_size > 0)
+        {
+            mapping_size = sb.st_size;
+            mapping = ::mmap (nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED)
+            {
+                ::madvise (mapping, mapping_size, MADV_SEQUENTIAL);
+                return;
+            }
+            mapping_size = 0;
+        }
+
+        // Fall back to reading it in large blocks
+        const size_t block_size = 1 << 20;
+        for (;;)
+        {
+            const size_t n = buffer.size ();
+            buffer.resize (n + block_size);
+            const ssize_t bytes = ::read (fd, buffer.data () + n, block_size);
+            if (bytes < 0)
+            {
+                if (errno == EINTR)
+                {
+                    buffer.resize (n);
+                    continue;
+                }
+                throw std::runtime_error ("Could not read file");
+            }
+            buffer.resize (n + bytes);
+            if (bytes == 0)
+                break;
+        }
+    }
+};
+
+namespace detail
+{
+
+// Get the end of the line that starts at 'p', not including the line
+// terminator
+inline const char *line_end (const char *p, const char *end)
+{
+    const char *q = static_cast<const char *> (memchr (p, '\n', end - p));
+    if (q == nullptr)
+        q = end;
+    // Ignore CRs in case the file was created under Windows
+    if (q != p && q[-1] == '\r')
+        --q;
+    return q;
+}
+
+// Get the start of the line following the line that starts at 'p'
+inline const char *next_line (const char *p, const char *end)
+{
+    const char *q = static_cast<const char *> (memchr (p, '\n', end - p));
+    return q == nullptr ? end : q + 1;
+}
+
+// Skip the field at 'p', which ends at or before 'eol', and return a
+// pointer to the start of the next field
+inline const char *skip_field (const char *p, const char *eol)
+{
+    const char *q = static_cast<const char *> (memchr (p, ',', eol - p));
+    return q == nullptr ? eol : q + 1;
+}
+
+// Parse the field at 'p', which ends at or before 'eol', and return a
+// pointer to the start of the next field
+inline const char *parse_field (const char *p, const char *eol, double &x)
+{
+    // Skip leading whitespace and '+', like strtod () does
+    while (p != eol && (*p == ' ' || *p == '\t'))
+        ++p;
+    if (p != eol && *p == '+')
+        ++p;
+
+    const auto r = std::from_chars (p, eol, x);
+
+    if (r.ec == std::errc::result_out_of_range)
+    {
+        // Let strtod () decide how to saturate it
+        char tmp[64] {};
+        memcpy (tmp, p, std::min<size_t> (r.ptr - p, sizeof (tmp) - 1));
+        x = strtod (tmp, nullptr);
+    }
+    else if (r.ec != std::errc ())
+    {
+        // Not a number
+        x = 0.0;
+    }
+
+    // Go to the next field
+    return skip_field (r.ptr, eol);
+}
+
+// Parse the header line at 'p' and return a pointer to the first row
+inline const char *parse_headers (const char *p, const char *end, std::vector<std::string> &headers)
+{
+    const char *eol = line_end (p, end);
 
     // Parse each individual column header
-    stringstream ss (line);
-    string header;
-    while (getline (ss, header, ','))
+    while (p < eol)
     {
+        const char *q = static_cast<const char *> (memchr (p, ',', eol - p));
+        if (q == nullptr)
+            q = eol;
+        std::string header (p, q);
+
         // Remove LFs in case the file was created under Windows
         std::erase (header, '\r');
 
         // Save it
-        df.headers.push_back (header);
+        headers.push_back (header);
+        p = q + 1;
+    }
+
+    return next_line (eol, end);
+}
+
+// Count the rows in [p, end), not including empty lines
+inline size_t count_rows (const char *p, const char *end)
+{
+    size_t rows = 0;
+    while (p < end)
+    {
+        const char *eol = line_end (p, end);
+        rows += (eol != p);
+        p = next_line (eol, end);
+    }
+    return rows;
+}
+
+// Stores parsed values in columns
+//
+// The columns are grouped by their types when it is created, so the type
+// of each column is only looked up once, instead of once per value.
+class column_writer
+{
+    public:
+    explicit column_writer (std::vector<std::vector<double>> &columns)
+    {
+        for (size_t i = 0; i < columns.size (); ++i)
+            add (i, columns[i].data ());
+    }
+    explicit column_writer (std::vector<column> &columns)
+    {
+        for (size_t i = 0; i < columns.size (); ++i)
+            columns[i].visit ([&] (auto &x) { add (i, x.data ()); });
     }
+    // Store 'values[i]' in row 'row' of column 'i'
+    void write (const size_t row, const std::vector<double> &values) const
+    {
+        write (float64, row, values);
+        write (float32, row, values);
+        write (int64, row, values);
+        write (uint8, row, values);
+    }
+
+    private:
+    // The index of each column of type 'T', and its values
+    template<typename T> using pointers = std::vector<std::pair<size_t, T *>>;
+    pointers<double> float64;
+    pointers<float> float32;
+    pointers<int64_t> int64;
+    pointers<uint8_t> uint8;
 
-    // Allocate column vectors
-    df.columns.resize (df.headers.size ());
+    void add (const size_t i, double *p) { float64.emplace_back (i, p); }
+    void add (const size_t i, float *p) { float32.emplace_back (i, p); }
+    void add (const size_t i, int64_t *p) { int64.emplace_back (i, p); }
+    void add (const size_t i, uint8_t *p) { uint8.emplace_back (i, p); }
 
-    // Now get the rows
-    while (getline (is, line))
+    template<typename T>
+    static void write (const pointers<T> &c, const size_t row, const std::vector<double> &values)
     {
+        for (const auto &i : c)
+            i.second[row] = convert<T> (values[i.first]);
+    }
+};
+
+// Parse the rows in [p, end), numbering them starting at 'row'
+//
+// 'fields' are the indexes of the fields that get parsed in each line.
+// It must be sorted. For each row, 'f (row, line, values)' gets called,
+// where 'line' is the start of the row and 'values[i]' is the value of
+// field 'fields[i]'.
+template<typename F>
+void for_each_row (const char *p,
+    const char *end,
+    const std::vector<size_t> &fields,
+    size_t row,
+    F f)
+{
+    assert (std::is_sorted (fields.begin (), fields.end ()));
+
+    std::vector<double> values (fields.size ());
+
+    while (p < end)
+    {
+        const char *eol = line_end (p, end);
+
         // Skip empty lines
-        if (line.empty ())
-            continue;
-        char *p = &line[0];
-        for (size_t i = 0; i < df.headers.size (); ++i)
+        if (eol != p)
         {
-            char *end;
-            const double x = strtod (p, &end);
-            df.columns[i].push_back (x);
-            p = end;
-            // Ignore ','
-            if (*p == ',')
-                ++p;
+            const char *line = p;
+            size_t field = 0;
+            for (size_t i = 0; i < fields.size (); ++i)
+            {
+                // Skip unwanted fields without converting them
+                for ( ; field < fields[i]; ++field)
+                    p = skip_field (p, eol);
+
+                p = parse_field (p, eol, values[i]);
+                ++field;
+            }
+            f (row, line, values);
+            ++row;
         }
+
+        p = next_line (eol, end);
     }
+}
 
-    assert (df.is_valid ());
-    return df;
+// Split [p, end) into at most 'n' chunks that each start on a line
+// boundary
+inline std::vector<const char *> split_lines (const char *p, const char *end, const size_t n)
+{
+    std::vector<const char *> chunks {p};
+    const size_t chunk_size = (end - p) / n;
+    for (size_t i = 1; i < n; ++i)
+    {
+        const char *q = std::max (chunks.back (), p + i * chunk_size);
+        // Don't split a line
+        if (q != p && q[-1] != '\n')
+            q = next_line (q, end);
+        if (q >= end)
+            break;
+        chunks.push_back (q);
+    }
+    chunks.push_back (end);
+    return chunks;
 }
 
-dataframe read (const std::string &fn)
+} // namespace detail
+
+namespace detail
+{
+
+// Create an empty dataframe from the header line at 'begin', only
+// keeping fields for which 'keep (header, column)' returns true
+//
+// 'keep ()' can also set the type of the column. Returns a pointer to
+// the first row. The indexes of the kept fields are stored in 'fields'.
+template<typename C,typename F>
+const char *read_headers (const char *begin,
+    const char *end,
+    F keep,
+    basic_dataframe<C> &df,
+    std::vector<size_t> &fields)
 {
     using namespace std;
 
-    ifstream ifs (fn);
-    if (!ifs)
-        throw runtime_error ("Could not open file for reading");
-    return ATL24_qtrees::dataframe::read (ifs);
+    vector<string> headers;
+    const char *p = parse_headers (begin, end, headers);
+
+    // Get the fields we are keeping, and allocate their columns
+    for (size_t i = 0; i < headers.size (); ++i)
+    {
+        C c;
+        if (!keep (headers[i], c))
+            continue;
+        fields.push_back (i);
+        df.headers.push_back (headers[i]);
+        df.columns.push_back (std::move (c));
+    }
+
+    return p;
 }
 
-std::ostream &write (std::ostream &os, const dataframe &df, const size_t precision = 16)
+// Parse the complete lines in [p, end) in parallel, numbering the rows
+// starting at 'first_row'
+//
+// The rows are counted first, and then 'allocate (rows)' gets called
+// with the total number of rows, including the first 'first_row' rows.
+// Then 'f' gets called for each row, as in for_each_row ().
+template<typename A,typename F>
+void parse_lines (const char *p,
+    const char *end,
+    const std::vector<size_t> &fields,
+    const size_t first_row,
+    A allocate,
+    F f)
 {
     using namespace std;
 
+    // Split the rows into chunks of at least 1MB, one per thread
+    const size_t min_chunk_size = 1 << 20;
+    const size_t max_chunks = std::max (omp_get_max_threads (), 1);
+    const size_t total_chunks = std::clamp<size_t> ((end - p) / min_chunk_size, 1, max_chunks);
+    const auto chunks = split_lines (p, end, total_chunks);
+
+    // Count the rows in each chunk to get each chunk's first row
+    const size_t n = chunks.size () - 1;
+    vector<size_t> offsets (n + 1);
+    offsets[0] = first_row;
+
+#pragma omp parallel for
+    for (size_t i = 0; i < n; ++i)
+        offsets[i + 1] = count_rows (chunks[i], chunks[i + 1]);
+
+    partial_sum (offsets.begin (), offsets.end (), offsets.begin ());
+
+    // Allocate the rows
+    allocate (offsets.back ());
+
+    // Now parse each chunk in place. Exceptions can't leave the parallel
+    // loop, so the first one is rethrown after it.
+    exception_ptr error;
+
+#pragma omp parallel for
+    for (size_t i = 0; i < n; ++i)
+    {
+        try
+        {
+            for_each_row (chunks[i], chunks[i + 1], fields, offsets[i], f);
+        }
+        catch (...)
+        {
+#pragma omp critical
+            if (!error)
+                error = current_exception ();
+        }
+    }
+
+    if (error)
+        rethrow_exception (error);
+}
+
+// Parse the complete lines in [p, end) and append them to 'df'
+template<typename C>
+void append_rows (const char *p,
+    const char *end,
+    const std::vector<size_t> &fields,
+    basic_dataframe<C> &df)
+{
+    assert (fields.size () == df.columns.size ());
+
+    // The columns are only resized once, when all of the rows have been
+    // counted, so they can't be written to until then
+    std::optional<column_writer> w;
+
+    parse_lines (p, end, fields, df.rows (),
+        [&] (const size_t rows)
+        {
+            for (auto &c : df.columns)
+                c.resize (rows);
+            w.emplace (df.columns);
+        },
+        [&] (const size_t row, const char *, const std::vector<double> &values)
+        {
+            assert (df.columns.empty () || row < df.columns[0].size ());
+            w->write (row, values);
+        });
+}
+
+// Parse the compressed dataframe in [begin, end)
+//
+// The data is decompressed on another thread, a block at a time, while
+// the previous block is being parsed.
+template<typename C,typename F>
+basic_dataframe<C> read_compressed (const char *begin, const char *end, F keep)
+{
+    using namespace std;
+
+    basic_dataframe<C> df;
+    vector<size_t> fields;
+    bool have_headers = false;
+
+    compression::threaded_decompressor d (begin, end);
+
+    // Lines that have not been parsed yet
+    vector<char> pending;
+
+    for (vector<char> block; d.next (block); )
+    {
+        pending.insert (pending.end (), block.begin (), block.end ());
+
+        // Only parse complete lines
+        const char *p = pending.data ();
+        const char *q = static_cast<const char *> (memrchr (p, '\n', pending.size ()));
+        if (q == nullptr)
+            continue;
+        ++q;
+
+        if (!have_headers)
+        {
+            p = read_headers (p, q, keep, df, fields);
+            have_headers = true;
+        }
+
+        append_rows (p, q, fields, df);
+
+        // Keep the partial line
+        pending.erase (pending.begin (), pending.begin () + (q - pending.data ()));
+    }
+
+    // The last line may not have a line terminator
+    if (!pending.empty ())
+    {
+        const char *p = pending.data ();
+        const char *q = p + pending.size ();
+        if (!have_headers)
+            p = read_headers (p, q, keep, df, fields);
+        append_rows (p, q, fields, df);
+    }
+
     assert (df.is_valid ());
+    return df;
+}
 
-    const size_t ncols = df.headers.size ();
+// Parse the dataframe in [begin, end), only keeping fields for which
+// 'keep (header, column)' returns true
+template<typename C,typename F>
+basic_dataframe<C> read (const char *begin, const char *end, F keep)
+{
+    using namespace std;
 
-    // Short-circuit
-    if (ncols == 0)
-        return os;
+    // Create the dataframe
+    basic_dataframe<C> df;
 
-    // Print headers
-    bool first = true;
-    for (const auto& h : df.headers)
+    // Read the headers
+    if (begin == end)
+        return df;
+
+    if (compression::detect (begin, end - begin) != compression::format::none)
+        return read_compressed<C> (begin, end, keep);
+
+    vector<size_t> fields;
+    const char *p = read_headers (begin, end, keep, df, fields);
+
+    // Parse the rows in parallel
+    append_rows (p, end, fields, df);
+
+    assert (df.is_valid ());
+    return df;
+}
+
+// Read a stream in large blocks
+inline std::vector<char> read_all (std::istream &is)
+{
+    std::vector<char> buffer;
+    const size_t block_size = 1 << 20;
+    while (is)
     {
-        if (!first)
-            os << ",";
-        first = false;
-        os << h;
+        const size_t n = buffer.size ();
+        buffer.resize (n + block_size);
+        is.read (buffer.data () + n, block_size);
+        buffer.resize (n + is.gcount ());
     }
-    os << endl;
+    return buffer;
+}
 
-    const size_t nrows = df.columns[0].size ();
+} // namespace detail
 
-    // Short-circuit
-    if (nrows == 0)
-        return os;
+dataframe read (const char *begin, const char *end)
+{
+    return detail::read<std::vector<double>> (begin, end,
+        [] (const std::string &, std::vector<double> &) { return true; });
+}
+
+// Only read the columns in 'column_names'
+//
+// Columns in 'column_names' that are not in the input are ignored.
+// Other columns in the input are skipped without being parsed.
+dataframe read (const char *begin, const char *end, const std::vector<std::string> &column_names)
+{
+    return detail::read<std::vector<double>> (begin, end, [&] (const std::string &h, std::vector<double> &)
+        { return std::find (column_names.begin (), column_names.end (), h) != column_names.end (); });
+}
+
+// The name and type of a column
+struct column_spec
+{
+    std::string name;
+    column_type type = column_type::float64;
+};
+
+// Read the columns in 'specs' as their given types
+//
+// If 'other_columns' is true, columns in the input that are not in
+// 'specs' are read as float64. Otherwise, they are skipped.
+typed_dataframe read_typed (const char *begin,
+    const char *end,
+    const std::vector<column_spec> &specs,
+    const bool other_columns = false)
+{
+    return detail::read<column> (begin, end, [&] (const std::string &h, column &c)
+    {
+        const auto it = std::find_if (specs.begin (), specs.end (),
+            [&] (const column_spec &spec) { return spec.name == h; });
+        if (it != specs.end ())
+            c = column (it->type);
+        return it != specs.end () || other_columns;
+    });
+}
+
+dataframe read (std::istream &is)
+{
+    const auto buffer = detail::read_all (is);
+    return ATL24_qtrees::dataframe::read (buffer.data (), buffer.data () + buffer.size ());
+}
+
+dataframe read (std::istream &is, const std::vector<std::string> &column_names)
+{
+    const auto buffer = detail::read_all (is);
+    return ATL24_qtrees::dataframe::read (buffer.data (), buffer.data () + buffer.size (), column_names);
+}
+
+dataframe read (const std::string &fn)
+{
+    // Map the file and parse it in place
+    const mapped_file f (fn);
+    return ATL24_qtrees::dataframe::read (f.data (), f.data () + f.size ());
+}
+
+dataframe read (const std::string &fn, const std::vector<std::string> &column_names)
+{
+    // Map the file and parse it in place
+    const mapped_file f (fn);
+    return ATL24_qtrees::dataframe::read (f.data (), f.data () + f.size (), column_names);
+}
+
+namespace detail
+{
+
+// Append 'x' to 'buffer' using 'tmp' as scratch space
+inline void format_value (const double x,
+    const size_t precision,
+    std::vector<char> &tmp,
+    std::string &buffer)
+{
+    const auto r = std::to_chars (tmp.data (),
+        tmp.data () + tmp.size (),
+        x,
+        std::chars_format::fixed,
+        precision);
+    assert (r.ec == std::errc ());
+    buffer.append (tmp.data (), r.ptr);
+}
+
+inline void format_value (const float x,
+    const size_t precision,
+    std::vector<char> &tmp,
+    std::string &buffer)
+{
+    format_value (static_cast<double> (x), precision, tmp, buffer);
+}
 
-    // Save format
-    const auto f = os.flags();
-    const auto p = os.precision();
+// Integers are formatted like integral doubles
+inline void format_value (const int64_t x,
+    const size_t precision,
+    std::vector<char> &tmp,
+    std::string &buffer)
+{
+    const auto r = std::to_chars (tmp.data (), tmp.data () + tmp.size (), x);
+    assert (r.ec == std::errc ());
+    buffer.append (tmp.data (), r.ptr);
+    if (precision != 0)
+    {
+        buffer.push_back ('.');
+        buffer.append (precision, '0');
+    }
+}
 
-    // Set format
-    os << std::fixed;
-    os << std::setprecision (precision);
+inline void format_value (const uint8_t x,
+    const size_t precision,
+    std::vector<char> &tmp,
+    std::string &buffer)
+{
+    format_value (static_cast<int64_t> (x), precision, tmp, buffer);
+}
 
-    // Write it out
-    for (size_t i = 0; i < nrows; ++i)
+// Append rows [begin, end) of 'df' to 'buffer' in CSV format
+//
+// Numbers are formatted the same way as 'os << fixed <<
+// setprecision (precision)', but without going through a stream.
+template<typename C>
+void format_rows (const basic_dataframe<C> &df,
+    const size_t precision,
+    const size_t begin,
+    const size_t end,
+    std::string &buffer)
+{
+    // Longest possible number: sign, 309 digits, point, and fraction
+    std::vector<char> tmp (precision + 320);
+    const size_t ncols = df.columns.size ();
+
+    for (size_t i = begin; i < end; ++i)
     {
         for (size_t j = 0; j < ncols; ++j)
         {
             if (j != 0)
-                os << ",";
-            os << df.columns[j][i];
+                buffer.push_back (',');
+            visit_column (df.columns[j], [&] (const auto &c)
+                { format_value (c[i], precision, tmp, buffer); });
+        }
+        buffer.push_back ('\n');
+    }
+}
+
+// Write 'nrows' rows to 'os'
+//
+// 'format (begin, end, buffer)' appends rows [begin, end) to 'buffer'.
+// Blocks of rows are formatted in parallel, one block per thread, and
+// then each block is written out with a single call.
+template<typename F>
+void write_rows (std::ostream &os, const size_t nrows, F format)
+{
+    using namespace std;
+
+    const size_t block_rows = 1 << 14;
+    const size_t max_blocks = std::max (omp_get_max_threads (), 1);
+    vector<string> blocks (max_blocks);
+
+    for (size_t first = 0; first < nrows; first += block_rows * max_blocks)
+    {
+        const size_t total_blocks = std::min (max_blocks,
+            (nrows - first + block_rows - 1) / block_rows);
+
+#pragma omp parallel for
+        for (size_t i = 0; i < total_blocks; ++i)
+        {
+            const size_t begin = first + i * block_rows;
+            const size_t end = std::min (begin + block_rows, nrows);
+            blocks[i].clear ();
+            format (begin, end, blocks[i]);
         }
-        os << endl;
+
+        for (size_t i = 0; i < total_blocks; ++i)
+            os.write (blocks[i].data (), blocks[i].size ());
     }
+}
+
+} // namespace detail
+
+template<typename C>
+std::ostream &write (std::ostream &os, const basic_dataframe<C> &df, const size_t precision = 16)
+{
+    using namespace std;
+
+    assert (df.is_valid ());
+
+    const size_t ncols = df.headers.size ();
+
+    // Short-circuit
+    if (ncols == 0)
+        return os;
+
+    // Print headers
+    string header;
+    for (size_t j = 0; j < ncols; ++j)
+    {
+        if (j != 0)
+            header.push_back (',');
+        header.append (df.headers[j]);
+    }
+    header.push_back ('\n');
+    os.write (header.data (), header.size ());
+
+    const size_t nrows = df.columns[0].size ();
 
-    // Restore format
-    os.precision (p);
-    os.flags (f);
+    detail::write_rows (os, nrows, [&] (const size_t begin, const size_t end, string &buffer)
+        { detail::format_rows (df, precision, begin, end, buffer); });
 
     return os;
 }
@@ -1,7 +1,6 @@
 #pragma once
 
 #include "precompiled.h"
-#include "classify_cmd.h"
 #include "ATL24_qtrees/blunder_detection.h"
 #include "ATL24_qtrees/utils.h"
 #include "ATL24_qtrees/xgboost.h"
@@ -19,8 +18,40 @@ struct postprocess_params
     double bathy_range = 3.0;
 };
 
+// Along-track distance whose features and predictions are computed at a
+// time
+constexpr double default_chunk_size = 10'000.0; // meters
+
+// Rows of features created at a time when getting predictions
+constexpr size_t default_batch_rows = 1 << 16;
+
+// Classify the photons in 'samples'
+//
+// Features and predictions are computed in along-track chunks of
+// 'chunk_size' meters, or for the whole track at once if 'chunk_size' is
+// 0. Rows of features are passed to the model 'batch_rows' at a time.
+// The results do not depend on 'chunk_size' or 'batch_rows'.
+//
+// Chunking only bounds the memory used by the features. The samples,
+// which are held for the whole track, still take memory proportional to
+// the length of the track.
+//
+// Tables of features that the model never splits on are not computed.
+// Their features are passed to the model as missing data, which it never
+// reads.
+//
+// Surface and bathy estimates and blunder detection are always done on
+// the whole track, because they can depend on photons that are
+// arbitrarily far away along the track: the elevation estimates
+// interpolate across gaps of any length, and blunder detection looks
+// for the nearest surface photon.
 template<typename T>
-T classify (const bool verbose, T samples, const std::string &model_filename)
+T classify (const bool verbose,
+    T samples,
+    const std::string &model_filename,
+    const double chunk_size = default_chunk_size,
+    const utils::feature_params &init_fp = utils::feature_params (),
+    const size_t batch_rows = default_batch_rows)
 {
     using namespace std;
     using namespace ATL24_qtrees::utils;
@@ -46,75 +77,132 @@ T classify (const bool verbose, T samples, const std::string &model_filename)
     // Sort indexes by X
     sort (sorted_indexes.begin (), sorted_indexes.end (),
         [&](const auto &a, const auto &b)
-        { return samples[a].x < samples[b].x; });
+        { return samples[a].x < samples[b].x || (samples[a].x == samples[b].x && a < b); });
 
     // Sort points by X
-    sort (samples.begin (), samples.end (),
-        [&](const auto &a, const auto &b)
-        { return a.x < b.x; });
+    gather_in_place (samples, sorted_indexes);
 
     // Create the booster
     xgbooster xgb (verbose);
     xgb.load_model (model_filename);
 
-    if (verbose)
-    {
-        clog << samples.size () << " samples read" << endl;
-        clog << "Creating features" << endl;
-    }
+    // Only compute the tables of features that the model uses. If it
+    // uses features from every table, compute all of them.
+    utils::feature_params fp (init_fp);
+    fp.used_features = xgb.get_used_features ();
 
-    feature_params fp;
-    features f (samples, fp);
+    const size_t total_features = get_features_per_sample (fp);
+    if (!fp.used_features.empty () && fp.used_features.back () >= total_features)
+        throw runtime_error (string ("The model uses feature ")
+            + to_string (fp.used_features.back ())
+            + ", but there are only "
+            + to_string (total_features)
+            + " features per sample");
 
-    // Create the raw data that gets passed to xgbooster
-    const size_t rows = samples.size ();
-    const size_t cols = f.features_per_sample ();
-    vector<float> features; features.reserve (rows * cols);
-    vector<uint32_t> labels; labels.reserve (rows);
+    if (verbose && !fp.used_features.empty ())
+        clog << "The model uses " << fp.used_features.size ()
+            << " of " << total_features << " features" << endl;
 
-    if (verbose)
-        clog << "Features per sample " << f.features_per_sample () << endl;
+    if (!skips_feature_tables (fp))
+        fp.used_features.clear ();
 
-    for (size_t i = 0; i < samples.size (); ++i)
+    if (verbose)
     {
-        // Get a row
-        const auto row = f.get_features (i);
-
-        // Append row to matrix
-        features.insert (features.end (), row.begin (), row.end ());
-
-        // Save the label
-        labels.push_back (samples[i].cls);
+        clog << samples.size () << " samples read" << endl;
+        clog << "Creating features" << endl;
     }
 
-    // Check invariants
-    assert (features.size () == rows * cols);
-    assert (labels.size () == rows);
-
-    // Get predictions
+    // Get the window index of each photon. Since the samples are sorted,
+    // the window indexes are too.
+    const auto window_indexes = samples.empty ()
+        ? vector<size_t> ()
+        : get_window_indexes (samples, fp.window_size);
+    const size_t total_windows = samples.empty () ? 0 : window_indexes.back () + 1;
+
+    // Get the predictions in along-track chunks so that the window
+    // features only have to be held for one chunk at a time.
+    //
+    // Each chunk also includes the photons in the 'adjacent_windows'
+    // windows on either side of it, in the rest of its pyramid windows,
+    // and within 'density_radius' of it, so the features, and therefore
+    // the predictions, are the same as they would be for the whole
+    // track.
+    const size_t chunk_windows = chunk_size > 0.0
+        ? std::max (static_cast<size_t> (chunk_size / fp.window_size), size_t (1))
+        : std::max (total_windows, size_t (1));
+
+    size_t correct = 0;
+
+    for (size_t first_window = 0; first_window < total_windows; first_window += chunk_windows)
     {
-        if (verbose)
+        // Skip over gaps in the track
+        const size_t next = lower_bound (window_indexes.begin (), window_indexes.end (), first_window) - window_indexes.begin ();
+        if (next == window_indexes.size ())
+            break;
+        first_window = std::max (first_window, window_indexes[next]);
+
+        const size_t last_window = std::min (first_window + chunk_windows, total_windows);
+
+        // Include the windows that the chunk's features are computed from
+        const auto [first_adjacent, last_adjacent] = get_feature_windows (fp,
+            first_window,
+            last_window,
+            total_windows);
+
+        // Get the range of photons in the chunk and in its adjacent windows
+        const auto get_index = [&] (const size_t w)
+        {
+            return lower_bound (window_indexes.begin (), window_indexes.end (), w) - window_indexes.begin ();
+        };
+        const size_t begin = get_index (first_window);
+        const size_t end = get_index (last_window);
+        const size_t adjacent_begin = get_index (first_adjacent);
+        const size_t adjacent_end = get_index (last_adjacent);
+
+        // Skip empty chunks
+        if (begin == end)
+            continue;
+
+        const span<const typename T::value_type> chunk (samples.data () + adjacent_begin, adjacent_end - adjacent_begin);
+        utils::features f (chunk,
+            fp,
+            vector<size_t> (window_indexes.begin () + adjacent_begin, window_indexes.begin () + adjacent_end),
+            first_adjacent,
+            last_adjacent,
+            total_windows);
+
+        const size_t rows = end - begin;
+        const size_t cols = f.features_per_sample ();
+
+        if (verbose && first_window == 0)
+            clog << "Features per sample " << f.features_per_sample () << endl;
+
+        // Get predictions. The rows of features that get passed to
+        // xgbooster are created from the window table a batch at a time.
+        if (verbose && first_window == 0)
             clog << "Getting predictions" << endl;
 
-        const auto predictions = xgb.predict (features, rows, cols);
+        const size_t offset = begin - adjacent_begin;
+        const auto predictions = xgb.predict (rows, cols,
+            [&] (const size_t i, const size_t j, float *matrix)
+            { f.write_features (offset + i, offset + j, matrix); },
+            batch_rows);
 
-        if (verbose)
+        // Assign predictions
+        assert (rows == predictions.size ());
+        for (size_t i = begin; i < end; ++i)
         {
-            size_t correct = 0;
-
-            assert (labels.size () == predictions.size ());
-            for (size_t i = 0; i < labels.size (); ++i)
-                correct += (labels[i] == predictions[i]);
-            clog << fixed;
-            clog << setprecision (1);
-            clog << 100.0 * correct / predictions.size () << "% correct" << endl;
-            clog << "Writing dataframe" << endl;
+            correct += (samples[i].cls == predictions[i - begin]);
+            samples[i].prediction = predictions[i - begin];
         }
+    }
 
-        // Assign predictions
-        assert (samples.size () == predictions.size ());
-        for (size_t i = 0; i < samples.size (); ++i)
-            samples[i].prediction = predictions[i];
+    if (verbose && !samples.empty ())
+    {
+        clog << fixed;
+        clog << setprecision (1);
+        clog << 100.0 * correct / samples.size () << "% correct" << endl;
+        clog << "Writing dataframe" << endl;
     }
 
     // Check predictions in multiple passes
@@ -154,12 +242,10 @@ T classify (const bool verbose, T samples, const std::string &model_filename)
 
     postprocess_params params;
 
-    samples = blunder_detection (samples, params);
+    samples = blunder_detection (std::move (samples), params);
 
     // Restore original order
-    auto tmp (samples);
-    for (size_t i = 0; i < sorted_indexes.size (); ++i)
-        samples[sorted_indexes[i]] = tmp[i];
+    scatter_in_place (samples, sorted_indexes);
 
     // Check invariants: The samples should be in the same order in which
     // they were read
@@ -0,0 +1,253 @@
+#pragma once
+
+#include "precompiled.h"
+#include "ATL24_qtrees/utils.h"
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <omp.h>
+
+namespace ATL24_qtrees
+{
+
+namespace search
+{
+
+// The result of training with one set of feature parameters
+struct result
+{
+    size_t index = 0;
+    double accuracy = 0.0;
+    utils::feature_params fp;
+    double seconds = 0.0;
+};
+
+// Write the header of the search results table
+void write_header (std::ostream &os)
+{
+    os << "index";
+    os << "\t" << "accuracy";
+    os << "\t" << "window_size";
+    os << "\t" << "total_quantiles";
+    os << "\t" << "adjacent_windows";
+    os << "\t" << "seconds";
+    os << std::endl;
+}
+
+// Write one row of the search results table
+void write_result (std::ostream &os, const result &r)
+{
+    os << r.index;
+    os << "\t" << r.accuracy;
+    os << "\t" << r.fp.window_size;
+    os << "\t" << r.fp.total_quantiles;
+    os << "\t" << r.fp.adjacent_windows;
+    os << "\t" << r.seconds;
+    os << std::endl;
+}
+
+// Get the number of threads that each of 'jobs' concurrent jobs gets
+size_t get_job_threads (const size_t total_threads, const size_t jobs)
+{
+    return std::max (total_threads / std::max (jobs, size_t (1)), size_t (1));
+}
+
+// Values that are shared by the jobs that use the same key
+//
+// The value for a key is created when it is first acquired, and it is
+// destroyed when it has been released as many times as it is going to
+// be acquired, so only the values that are in use are kept.
+template<typename K,typename V,typename F>
+class shared_values
+{
+    public:
+    // 'create (key)' creates the value for 'key', which will be acquired
+    // 'users[key]' times
+    shared_values (F init_create, const std::map<K,size_t> &users)
+        : create (init_create)
+    {
+        for (const auto &i : users)
+            entries[i.first].users = i.second;
+    }
+    const V &acquire (const K &key)
+    {
+        entry &e = get_entry (key);
+
+        // Jobs that need a value that is being created wait for it
+        std::lock_guard<std::mutex> lock (e.m);
+        if (!e.value)
+            e.value = std::make_unique<V> (create (key));
+        return *e.value;
+    }
+    void release (const K &key)
+    {
+        entry &e = get_entry (key);
+
+        std::lock_guard<std::mutex> lock (e.m);
+        assert (e.users > 0);
+        if (--e.users == 0)
+            e.value.reset ();
+    }
+
+    // Releases a value when it goes out of scope
+    class lease
+    {
+        public:
+        lease (shared_values &init_values, const K &init_key)
+            : values (init_values)
+            , key (init_key)
+            , value (values.acquire (key))
+        {
+        }
+        ~lease ()
+        {
+            values.release (key);
+        }
+        lease (const lease &) = delete;
+        lease &operator= (const lease &) = delete;
+        const V &get () const
+        {
+            return value;
+        }
+
+        private:
+        shared_values &values;
+        const K key;
+        const V &value;
+    };
+
+    private:
+    struct entry
+    {
+        std::mutex m;
+        size_t users = 0;
+        std::unique_ptr<V> value;
+    };
+    F create;
+    // The keys don't change after construction, so the map can be read
+    // concurrently
+    std::map<K,entry> entries;
+
+    entry &get_entry (const K &key)
+    {
+        const auto i = entries.find (key);
+        if (i == entries.end ())
+            throw std::runtime_error ("Unexpected key in shared values");
+        return i->second;
+    }
+};
+
+// Train a model with each of the feature parameters in 'fps', running
+// 'jobs' of them at a time
+//
+// The threads are split evenly between the jobs.
+//
+// 'create_windows (window_size)' creates the windows for a window size.
+// The windows for a window size are only created once, when the first
+// parameters with that window size need them, and they are destroyed
+// when all of those parameters have been trained.
+//
+// 'evaluate (fp, windows, threads)' trains a model with the parameters
+// 'fp' using 'threads' threads, and returns its accuracy.
+//
+// 'report (result)' gets called with each result as soon as it is
+// computed. It is only called by one job at a time.
+//
+// If a job throws, the parameters that haven't been started yet are
+// skipped, and the first exception is rethrown after the running jobs
+// finish.
+//
+// Returns the accuracy for each of the feature parameters.
+template<typename C,typename E,typename R>
+std::vector<double> run (const std::vector<utils::feature_params> &fps,
+    const size_t jobs,
+    const size_t total_threads,
+    C create_windows,
+    E evaluate,
+    R report)
+{
+    using namespace std;
+    using W = invoke_result_t<C, double>;
+
+    // Count the parameters that use each window size
+    map<double,size_t> users;
+    for (const auto &fp : fps)
+        ++users[fp.window_size];
+
+    shared_values<double,W,C> windows (create_windows, users);
+
+    const size_t total_jobs = std::clamp (jobs, size_t (1), std::max (fps.size (), size_t (1)));
+    const size_t job_threads = get_job_threads (total_threads, total_jobs);
+
+    // Compute accuracy for each set of parameters
+    vector<double> accuracies (fps.size ());
+
+    // Exceptions can't leave the parallel loop, so the first one gets
+    // rethrown after it
+    exception_ptr error;
+    atomic<bool> failed (false);
+
+    const int max_active_levels = omp_get_max_active_levels ();
+    omp_set_max_active_levels (2);
+
+#pragma omp parallel for num_threads(total_jobs) schedule(dynamic)
+    for (size_t i = 0; i < fps.size (); ++i)
+    {
+        if (failed)
+            continue;
+
+        try
+        {
+            omp_set_num_threads (job_threads);
+
+            const auto start = chrono::steady_clock::now ();
+
+            const auto &fp = fps[i];
+            double accuracy = 0.0;
+            {
+                // The windows are released even if 'evaluate' throws
+                typename decltype (windows)::lease w (windows, fp.window_size);
+                accuracy = evaluate (fp, w.get (), job_threads);
+            }
+            accuracies[i] = accuracy;
+
+            const chrono::duration<double> seconds = chrono::steady_clock::now () - start;
+
+            // Exceptions can't leave the critical section either
+#pragma omp critical
+            {
+                try
+                {
+                    report (result {i, accuracy, fp, seconds.count ()});
+                }
+                catch (...)
+                {
+                    if (!error)
+                        error = current_exception ();
+                    failed = true;
+                }
+            }
+        }
+        catch (...)
+        {
+#pragma omp critical
+            {
+                if (!error)
+                    error = current_exception ();
+                failed = true;
+            }
+        }
+    }
+
+    omp_set_max_active_levels (max_active_levels);
+
+    if (error)
+        rethrow_exception (error);
+
+    return accuracies;
+}
+
+} // namespace search
+
+} // namespace ATL24_qtrees
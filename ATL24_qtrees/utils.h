@@ -1,11 +1,31 @@
 #pragma once
 
+#include "ATL24_qtrees/columnar.h"
 #include "ATL24_qtrees/dataframe.h"
+#include "ATL24_qtrees/features.h"
 
 const std::string pi_name ("index_ph");
 const std::string x_name ("x_atc");
 const std::string z_name ("geoid_corr_h");
 
+// The dataframe columns used by convert_dataframe (), and their types
+//
+// If 'single_precision' is true, elevations are stored as float32.
+// Along-track distances need to stay float64.
+inline std::vector<ATL24_qtrees::dataframe::column_spec> get_sample_columns (const bool single_precision = false)
+{
+    using ATL24_qtrees::dataframe::column_type;
+    const auto elevation_type = single_precision ? column_type::float32 : column_type::float64;
+    return {
+        {pi_name, column_type::int64},
+        {x_name, column_type::float64},
+        {z_name, elevation_type},
+        {"manual_label", column_type::uint8},
+        {"prediction", column_type::uint8},
+        {"sea_surface_h", elevation_type},
+        {"bathy_h", elevation_type}};
+}
+
 namespace ATL24_qtrees
 {
 
@@ -68,6 +88,17 @@ struct feature_params
     double window_size = 40.0; // meters
     size_t total_quantiles = 32;
     size_t adjacent_windows = 2;
+    // Each level of the pyramid has windows twice as wide as the level
+    // below it
+    size_t pyramid_levels = 0;
+    // Count each photon's neighbors within 'density_radius'
+    bool density = false;
+    double density_radius = 1.0; // meters
+    // Indexes of the features that are needed, in ascending order. The
+    // tables that none of them are read from are not computed, and their
+    // features are written as missing data. If empty, all of the
+    // features are needed.
+    std::vector<size_t> used_features;
 };
 
 std::ostream &operator<< (std::ostream &os, const feature_params &fp)
@@ -77,9 +108,80 @@ std::ostream &operator<< (std::ostream &os, const feature_params &fp)
     os << "window_size: " << fp.window_size << std::endl;
     os << "total_quantiles: " << fp.total_quantiles << std::endl;
     os << "adjacent_windows: " << fp.adjacent_windows << std::endl;
+    os << "pyramid_levels: " << fp.pyramid_levels << std::endl;
+    os << "density: " << fp.density << std::endl;
+    os << "density_radius: " << fp.density_radius << std::endl;
+    os << "used_features: " << fp.used_features.size () << std::endl;
     return os;
 }
 
+size_t get_features_per_sample (const feature_params &fp)
+{
+    // total features =
+    //        photon elevation
+    //      + quantiles in photon's window
+    //      + quantiles in adjacent windows
+    //      + quantiles in photon's window at each pyramid level
+    //      + photon density
+    return    1
+            + fp.total_quantiles
+            + (2 * fp.adjacent_windows) * fp.total_quantiles
+            + fp.pyramid_levels * fp.total_quantiles
+            + (fp.density ? 1 : 0);
+}
+
+// The tables that the features are read from
+struct feature_tables
+{
+    // Quantiles for each window, read by the photon's window and
+    // adjacent window features
+    bool windows = false;
+    // Quantiles for each window at each pyramid level
+    bool pyramid = false;
+    // Number of neighbors of each photon
+    bool density = false;
+    bool operator== (const feature_tables &) const = default;
+};
+
+// Get the tables that the features in 'fp.used_features' are read from,
+// or all of the tables if it is empty
+feature_tables get_feature_tables (const feature_params &fp)
+{
+    using namespace std;
+
+    // Are any of the features in [first, last) used?
+    const auto uses = [&] (const size_t first, const size_t last)
+    {
+        if (fp.used_features.empty ())
+            return first < last;
+
+        const auto i = lower_bound (fp.used_features.begin (), fp.used_features.end (), first);
+        return i != fp.used_features.end () && *i < last;
+    };
+
+    const size_t nq = fp.total_quantiles;
+    const size_t window_columns = 1 + nq + 2 * fp.adjacent_windows * nq;
+    const size_t pyramid_columns = window_columns + fp.pyramid_levels * nq;
+
+    feature_tables t;
+    t.windows = uses (1, window_columns);
+    t.pyramid = uses (window_columns, pyramid_columns);
+    t.density = fp.density && uses (pyramid_columns, pyramid_columns + 1);
+    return t;
+}
+
+// Does only computing the features in 'fp.used_features' skip any of the
+// tables?
+//
+// Rows of features always include every feature, so features are only
+// worth leaving out when a whole table can be left out with them.
+bool skips_feature_tables (const feature_params &fp)
+{
+    feature_params all (fp);
+    all.used_features.clear ();
+    return get_feature_tables (fp) != get_feature_tables (all);
+}
+
 uint32_t remap_label (const uint32_t label)
 {
     switch (label)
@@ -90,195 +192,1479 @@ uint32_t remap_label (const uint32_t label)
     }
 }
 
-uint32_t unremap_label (const uint32_t label)
-{
-    switch (label)
+uint32_t unremap_label (const uint32_t label)
+{
+    switch (label)
+    {
+        default: return 0;
+        case 1: return 40;
+        case 2: return 41;
+    }
+}
+
+struct window
+{
+    std::vector<double> quantiles;
+};
+
+// Allocates memory aligned for SIMD, and leaves new elements
+// uninitialized instead of zeroing them
+template<typename T,size_t A = 64>
+struct aligned_allocator
+{
+    using value_type = T;
+    template<typename U> struct rebind { using other = aligned_allocator<U, A>; };
+    aligned_allocator () = default;
+    template<typename U> aligned_allocator (const aligned_allocator<U, A> &) { }
+    T *allocate (const size_t n)
+    {
+        return static_cast<T *> (::operator new (n * sizeof (T), std::align_val_t (A)));
+    }
+    void deallocate (T *p, const size_t)
+    {
+        ::operator delete (p, std::align_val_t (A));
+    }
+    template<typename U>
+    void construct (U *p)
+    {
+        ::new (static_cast<void *> (p)) U;
+    }
+    template<typename U,typename... Args>
+    void construct (U *p, Args&&... args)
+    {
+        ::new (static_cast<void *> (p)) U (std::forward<Args> (args)...);
+    }
+    bool operator== (const aligned_allocator &) const { return true; }
+};
+
+// Row-major matrix of features, one row per sample
+using feature_matrix = std::vector<float, aligned_allocator<float>>;
+
+template<typename T>
+std::vector<size_t> get_window_indexes (const T &samples, const double &window_size)
+{
+    using namespace std;
+
+    const double min_x = min_element (samples.begin (), samples.end (),
+        [] (const auto &a, const auto &b) { return a.x < b.x; })->x;
+
+    // Get the index for each photon
+    std::vector<size_t> indexes (samples.size ());
+
+#pragma omp parallel for
+    for (size_t i = 0; i < samples.size (); ++i)
+    {
+        // What is the photon's window index?
+        const size_t index = (samples[i].x - min_x) / window_size;
+        indexes[i] = index;
+    }
+
+    return indexes;
+}
+
+// Get the windows that the features of the samples in windows
+// [first_window, last_window) are computed from, out of a track with
+// 'total_windows' windows
+//
+// These are the 'adjacent_windows' windows on either side, the rest of
+// the windows under them at the top of the pyramid, and the windows that
+// contain the neighbors used for density. Returns the first window and
+// one past the last window.
+std::pair<size_t,size_t> get_feature_windows (const feature_params &fp,
+    const size_t first_window,
+    const size_t last_window,
+    const size_t total_windows)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (first_window < last_window);
+    assert (last_window <= total_windows);
+
+    // Windows on either side of a photon that can contain its neighbors
+    const size_t density_windows = fp.density
+        ? static_cast<size_t> (ceil (fp.density_radius / fp.window_size)) + 1
+        : 0;
+
+    const size_t levels = fp.pyramid_levels;
+    const size_t adjacent = std::max (fp.adjacent_windows, density_windows);
+    const size_t first = std::min (first_window - std::min (first_window, adjacent),
+        (first_window >> levels) << levels);
+    const size_t last = std::min (std::max (last_window + adjacent,
+        (((last_window - 1) >> levels) + 1) << levels), total_windows);
+
+    return {first, last};
+}
+
+namespace detail
+{
+
+// Scratch space for sorting
+struct sort_buffers
+{
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> tmp;
+    std::vector<size_t> counts;
+    std::vector<size_t> starts;
+};
+
+// Map a double to an unsigned integer that sorts in the same order
+inline uint64_t get_radix_key (const double x)
+{
+    uint64_t u;
+    memcpy (&u, &x, sizeof (u));
+    const uint64_t sign = uint64_t (1) << 63;
+    return (u & sign) ? ~u : (u | sign);
+}
+
+inline double get_radix_value (const uint64_t key)
+{
+    const uint64_t sign = uint64_t (1) << 63;
+    const uint64_t u = (key & sign) ? (key & ~sign) : ~key;
+    double x;
+    memcpy (&x, &u, sizeof (x));
+    return x;
+}
+
+// Sort [x, x + n) with an LSD radix sort
+//
+// Passes in which every key has the same digit are skipped, which is
+// most of the high order passes since elevations have a small range.
+inline void radix_sort (double *x, const size_t n, sort_buffers &b)
+{
+    const unsigned bits = 11;
+    const size_t buckets = size_t (1) << bits;
+    const size_t mask = buckets - 1;
+    const unsigned passes = (64 + bits - 1) / bits;
+
+    b.keys.resize (n);
+    b.tmp.resize (n);
+    b.counts.assign (passes * buckets, 0);
+
+    // Get keys, and count the digits for all passes at once
+    for (size_t i = 0; i < n; ++i)
+    {
+        const uint64_t key = get_radix_key (x[i]);
+        b.keys[i] = key;
+        for (unsigned p = 0; p < passes; ++p)
+            ++b.counts[p * buckets + ((key >> (p * bits)) & mask)];
+    }
+
+    uint64_t *src = b.keys.data ();
+    uint64_t *dst = b.tmp.data ();
+
+    for (unsigned p = 0; p < passes; ++p)
+    {
+        size_t *counts = b.counts.data () + p * buckets;
+        const unsigned shift = p * bits;
+
+        // Skip it if all digits are the same
+        if (counts[(src[0] >> shift) & mask] == n)
+            continue;
+
+        // Get the first position of each digit
+        size_t total = 0;
+        for (size_t i = 0; i < buckets; ++i)
+        {
+            const size_t count = counts[i];
+            counts[i] = total;
+            total += count;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+            dst[counts[(src[i] >> shift) & mask]++] = src[i];
+
+        std::swap (src, dst);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        x[i] = get_radix_value (src[i]);
+}
+
+inline void insertion_sort (double *x, const size_t n)
+{
+    for (size_t i = 1; i < n; ++i)
+    {
+        const double y = x[i];
+        size_t j = i;
+        for ( ; j > 0 && y < x[j - 1]; --j)
+            x[j] = x[j - 1];
+        x[j] = y;
+    }
+}
+
+// Sort [x, x + n)
+inline void sort_values (double *x, const size_t n, sort_buffers &b)
+{
+    const size_t max_insertion_sort = 64;
+    const size_t min_radix_sort = 512;
+
+    if (n <= max_insertion_sort)
+        insertion_sort (x, n);
+    else if (n < min_radix_sort)
+        std::sort (x, x + n);
+    else
+        radix_sort (x, n, b);
+}
+
+} // namespace detail
+
+// Number of quantiles that get_sorted_quantiles() is specialized for
+constexpr size_t specialized_total_quantiles = feature_params ().total_quantiles;
+
+// Get the average value in each of the 'nq' quantiles of 'x', which
+// must be sorted
+//
+// If 'NQ' is not 0, it must be equal to 'total_quantiles', and the
+// loops over the quantiles have a fixed length. If it is 0, the
+// specialized version is used when 'total_quantiles' matches it.
+template<size_t NQ = 0,typename T>
+std::vector<double> get_sorted_quantiles (const T &x, const size_t total_quantiles, detail::sort_buffers &b)
+{
+    using namespace std;
+
+    // Use the specialized version if it applies
+    if constexpr (NQ == 0)
+        if (total_quantiles == specialized_total_quantiles)
+            return get_sorted_quantiles<specialized_total_quantiles> (x, total_quantiles, b);
+
+    assert (NQ == 0 || NQ == total_quantiles);
+    const size_t nq = NQ != 0 ? NQ : total_quantiles;
+    const size_t n = x.size ();
+
+    vector<double> q (nq);
+    if (n < nq)
+        return q;
+
+    assert (is_sorted (x.begin (), x.end ()));
+
+    // Photon 'i' is in quantile 'i / photons_per_quantile'. Get the first
+    // photon in each quantile. Since there are at least as many photons as
+    // quantiles, no quantile is empty.
+    const double photons_per_quantile = static_cast<double> (n) / nq;
+    const auto get_index = [&] (const size_t i) { return static_cast<size_t> (i / photons_per_quantile); };
+
+    auto &starts = b.starts;
+    starts.resize (nq + 1);
+    for (size_t k = 0; k < nq; ++k)
+    {
+        size_t i = std::min (static_cast<size_t> (ceil (k * photons_per_quantile)), n);
+        while (i > 0 && get_index (i - 1) >= k)
+            --i;
+        while (i < n && get_index (i) < k)
+            ++i;
+        starts[k] = i;
+    }
+    starts[nq] = n;
+
+    // Add up each quantile's photons, several quantiles at a time. Each
+    // quantile's photons are still added in order, so the sums don't
+    // depend on how it gets vectorized.
+    size_t min_count = n;
+    for (size_t k = 0; k < nq; ++k)
+        min_count = std::min (min_count, starts[k + 1] - starts[k]);
+    assert (min_count > 0);
+
+    for (size_t j = 0; j < min_count; ++j)
+    {
+#pragma omp simd
+        for (size_t k = 0; k < nq; ++k)
+            q[k] += x[starts[k] + j];
+    }
+
+    for (size_t k = 0; k < nq; ++k)
+        for (size_t i = starts[k] + min_count; i < starts[k + 1]; ++i)
+            q[k] += x[i];
+
+    // Get the quantile's average value
+#pragma omp simd
+    for (size_t k = 0; k < nq; ++k)
+        q[k] /= starts[k + 1] - starts[k];
+
+    return q;
+}
+
+// Get the average value in each of the 'fp.total_quantiles' quantiles of
+// 'x'
+//
+// 'x' gets sorted in place.
+template<typename T,typename U>
+std::vector<double> get_quantiles (T &x, const U &fp, detail::sort_buffers &b)
+{
+    const size_t n = x.size ();
+    const size_t nq = fp.total_quantiles;
+
+    if (n < nq)
+        return std::vector<double> (nq);
+
+    // Order them
+    detail::sort_values (x.data (), n, b);
+
+    return get_sorted_quantiles (std::span<const double> (x.data (), n), nq, b);
+}
+
+namespace detail
+{
+
+// Move the elevations that are in range to the front of 'x'
+//
+// Returns the number of elevations that are in range.
+inline size_t keep_in_range (std::span<double> x)
+{
+    const auto last = std::remove_if (x.begin (), x.end (),
+            [](double z) {
+                return !(z > constants::min_photon_elevation
+                         && z < constants::max_photon_elevation);
+            });
+    return last - x.begin ();
+}
+
+} // namespace detail
+
+// Create a window from the elevations of its photons
+//
+// Elevations that are out of range are removed from 'elevations', and
+// the rest are sorted in place.
+template<typename U>
+window create_window (std::vector<double> &elevations, const U &fp, detail::sort_buffers &b)
+{
+    // Throw out elevations that are out of range
+    elevations.resize (detail::keep_in_range (elevations));
+
+    return window {get_quantiles (elevations, fp, b)};
+}
+
+// create_window() overload
+//
+// The elevations that are in range are sorted in place at the front of
+// 'elevations'.
+template<typename U>
+window create_window (std::span<double> elevations, const U &fp, detail::sort_buffers &b)
+{
+    auto kept = elevations.first (detail::keep_in_range (elevations));
+
+    return window {get_quantiles (kept, fp, b)};
+}
+
+// Elevations grouped by window
+//
+// The elevations in window 'i' are stored contiguously in
+// values[offsets[i]] to values[offsets[i + 1] - 1].
+struct window_elevations
+{
+    std::vector<double> values;
+    std::vector<size_t> offsets;
+    size_t size () const
+    {
+        return offsets.empty () ? 0 : offsets.size () - 1;
+    }
+    std::span<double> operator[] (const size_t i)
+    {
+        assert (i + 1 < offsets.size ());
+        return std::span<double> (values.data () + offsets[i], offsets[i + 1] - offsets[i]);
+    }
+};
+
+namespace detail
+{
+
+// Group the values of 'total' items by key
+//
+// 'key (i)' is the key of item 'i', and items with keys that are not in
+// [0, n) are ignored. The values of the items with key 'j' are stored
+// contiguously in values[offsets[j]] to values[offsets[j + 1] - 1].
+//
+// Each thread counts the items with each key for its own block of
+// items, and then copies their values into place, so the items with
+// each key stay in the same order as they were.
+template<typename T,typename K,typename F>
+void group_by_key (const size_t total,
+    const size_t n,
+    K key,
+    F value,
+    std::vector<T> &values,
+    std::vector<size_t> &offsets)
+{
+    using namespace std;
+
+    offsets.assign (n + 1, 0);
+
+    // Counts for each thread, and then where each thread's next value
+    // goes
+    vector<size_t> counts;
+
+#pragma omp parallel
+    {
+#pragma omp single
+        counts.resize (omp_get_num_threads () * n);
+
+        size_t *c = counts.data () + omp_get_thread_num () * n;
+
+#pragma omp for schedule(static)
+        for (size_t i = 0; i < total; ++i)
+        {
+            const size_t j = key (i);
+            if (j < n)
+                ++c[j];
+        }
+
+        // Get the offsets
+#pragma omp single
+        {
+            const size_t threads = counts.size () / std::max (n, size_t (1));
+            size_t sum = 0;
+            for (size_t j = 0; j < n; ++j)
+            {
+                offsets[j] = sum;
+                for (size_t t = 0; t < threads; ++t)
+                {
+                    const size_t count = counts[t * n + j];
+                    counts[t * n + j] = sum;
+                    sum += count;
+                }
+            }
+            offsets[n] = sum;
+            values.resize (sum);
+        }
+
+        // Copy the values into place. The static schedule gives each
+        // thread the same items that it counted.
+#pragma omp for schedule(static)
+        for (size_t i = 0; i < total; ++i)
+        {
+            const size_t j = key (i);
+            if (j < n)
+                values[c[j]++] = value (i);
+        }
+    }
+}
+
+} // namespace detail
+
+// Group the elevations of the samples by their window indexes, for the
+// windows with indexes in [first_window, first_window + n)
+//
+// Samples in other windows are ignored, and the samples in each window
+// stay in the same order as in 'samples'.
+template<typename T,typename V>
+window_elevations get_window_elevations (const T &samples,
+    const V &window_indexes,
+    const size_t first_window,
+    const size_t n)
+{
+    // Check logic
+    assert (samples.size () == window_indexes.size ());
+
+    window_elevations e;
+    detail::group_by_key (samples.size (), n,
+        [&] (const size_t i) { return window_indexes[i] - first_window; },
+        [&] (const size_t i) { return samples[i].z; },
+        e.values, e.offsets);
+
+    return e;
+}
+
+// Get the windows with indexes in [first_window, first_window + n)
+template<typename T,typename U,typename V>
+std::vector<window> get_windows (const T &samples,
+    const U &fp,
+    const V &window_indexes,
+    const size_t first_window,
+    const size_t n)
+{
+    using namespace std;
+
+    // Get the elevations in each window
+    auto elevations = get_window_elevations (samples, window_indexes, first_window, n);
+
+    std::vector<window> w (n);
+
+#pragma omp parallel
+    {
+        detail::sort_buffers b;
+
+#pragma omp for
+        for (size_t i = 0; i < w.size (); ++i)
+            w[i] = create_window (elevations[i], fp, b);
+    }
+
+    return w;
+}
+
+template<typename T,typename U,typename V>
+std::vector<window> get_windows (const T &samples,
+    const U &fp,
+    const V &window_indexes)
+{
+    using namespace std;
+
+    // Get the number of windows needed for all samples
+    const size_t max_index = *max_element (window_indexes.begin (), window_indexes.end ());
+    const size_t n = max_index + 1;
+
+    return get_windows (samples, fp, window_indexes, 0, n);
+}
+
+// Count each sample's neighbors within 'radius' in (x, z)
+//
+// The samples are put on a grid of cells that are 'radius' wide in both
+// x and z, so only the cells around a sample's cell are searched. Only
+// the occupied cells are stored, in a hash table, so memory scales with
+// the number of samples, not with the extent of the track.
+//
+// If 'selected' is specified, only the neighbors of the samples in
+// 'selected' are counted, and the others have a count of 0.
+template<typename T>
+std::vector<size_t> get_densities (const T &samples,
+    const double radius,
+    const std::vector<size_t> *selected = nullptr)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (radius > 0.0);
+
+    vector<size_t> densities (samples.size ());
+    if (samples.empty ())
+        return densities;
+
+    const auto [min_x, max_x] = minmax_element (samples.begin (), samples.end (),
+        [] (const auto &a, const auto &b) { return a.x < b.x; });
+    const auto [min_z, max_z] = minmax_element (samples.begin (), samples.end (),
+        [] (const auto &a, const auto &b) { return a.z < b.z; });
+    const double x0 = min_x->x;
+    const double z0 = min_z->z;
+
+    // A cell's key is its column along the track times the number of rows
+    // plus its row
+    const uint64_t rows = static_cast<uint64_t> ((max_z->z - z0) / radius) + 1;
+    const double columns = floor ((max_x->x - x0) / radius) + 1;
+    if (!(columns * rows < 0x1p63))
+        throw runtime_error ("The density radius is too small for the extent of the samples");
+
+    // Get each sample's cell key
+    vector<uint64_t> keys (samples.size ());
+
+#pragma omp parallel for
+    for (size_t i = 0; i < samples.size (); ++i)
+        keys[i] = static_cast<uint64_t> ((samples[i].x - x0) / radius) * rows
+            + static_cast<uint64_t> ((samples[i].z - z0) / radius);
+
+    // Number the occupied cells
+    unordered_map<uint64_t,size_t> cells;
+    vector<size_t> cell_indexes (samples.size ());
+    for (size_t i = 0; i < samples.size (); ++i)
+        cell_indexes[i] = cells.try_emplace (keys[i], cells.size ()).first->second;
+
+    // Put the samples into their cells
+    struct point { double x; double z; };
+    vector<point> points;
+    vector<size_t> offsets;
+    detail::group_by_key (samples.size (), cells.size (),
+        [&] (const size_t i) { return cell_indexes[i]; },
+        [&] (const size_t i) { return point {samples[i].x, samples[i].z}; },
+        points, offsets);
+
+    // Count the neighbors, not including the sample itself
+    const auto count = [&] (const size_t i)
+    {
+        const double x = samples[i].x;
+        const double z = samples[i].z;
+        const uint64_t column = keys[i] / rows;
+        const uint64_t row = keys[i] % rows;
+        size_t n = 0;
+        for (uint64_t u = column - std::min (column, uint64_t (1)); u <= column + 1; ++u)
+        {
+            for (uint64_t v = row - std::min (row, uint64_t (1)); v <= std::min (row + 1, rows - 1); ++v)
+            {
+                const auto c = cells.find (u * rows + v);
+                if (c == cells.end ())
+                    continue;
+                for (size_t j = offsets[c->second]; j < offsets[c->second + 1]; ++j)
+                {
+                    const auto &p = points[j];
+                    n += (p.x - x) * (p.x - x) + (p.z - z) * (p.z - z) <= radius * radius;
+                }
+            }
+        }
+        return n > 0 ? n - 1 : n;
+    };
+
+    if (selected == nullptr)
+    {
+#pragma omp parallel for
+        for (size_t i = 0; i < samples.size (); ++i)
+            densities[i] = count (i);
+    }
+    else
+    {
+#pragma omp parallel for
+        for (size_t k = 0; k < selected->size (); ++k)
+            densities[(*selected)[k]] = count ((*selected)[k]);
+    }
+
+    return densities;
+}
+
+// Get the elevation, density, and window index of each sample
+//
+// 'window_indexes' are the samples' window indexes. If 'selected' is
+// specified, only the densities of the samples in 'selected' are
+// counted, and the others have a density of 0.
+template<typename T>
+std::vector<ATL24_qtrees::features::photon_features> get_photon_features (const T &samples,
+    const feature_params &fp,
+    const std::vector<size_t> &window_indexes,
+    const std::vector<size_t> *selected = nullptr)
+{
+    // Check invariants
+    assert (window_indexes.size () == samples.size ());
+
+    const auto densities = get_densities (samples, fp.density_radius, selected);
+
+    std::vector<ATL24_qtrees::features::photon_features> p (samples.size ());
+
+#pragma omp parallel for
+    for (size_t i = 0; i < p.size (); ++i)
+        p[i] = ATL24_qtrees::features::photon_features {samples[i].z, static_cast<double> (densities[i]), window_indexes[i]};
+
+    return p;
+}
+
+template<typename T>
+std::vector<ATL24_qtrees::features::photon_features> get_photon_features (const T &samples,
+    const feature_params &fp)
+{
+    return get_photon_features (samples, fp, get_window_indexes (samples, fp.window_size));
+}
+
+// Get the window indexes that are in 'window_indexes', in ascending
+// order
+inline std::vector<size_t> get_occupied_windows (const std::vector<size_t> &window_indexes)
+{
+    using namespace std;
+
+    vector<size_t> w (window_indexes);
+    if (!is_sorted (w.begin (), w.end ()))
+        sort (w.begin (), w.end ());
+    w.erase (unique (w.begin (), w.end ()), w.end ());
+
+    return w;
+}
+
+// The sorted, in range elevations in each window of a track that has
+// samples in it
+//
+// Windows only depend on the window size, so features with different
+// numbers of quantiles or adjacent windows can share them.
+struct sorted_windows
+{
+    double window_size = 0.0;
+    // Window index of each sample
+    std::vector<size_t> window_indexes;
+    // Window index of each row, in ascending order
+    std::vector<size_t> window_numbers;
+    window_elevations elevations;
+    // Number of elevations in each row that are in range
+    std::vector<size_t> sizes;
+
+    size_t total_windows () const
+    {
+        return window_numbers.empty () ? 0 : window_numbers.back () + 1;
+    }
+    // Get the row of the window with index 'i'
+    size_t get_row (const size_t i) const
+    {
+        const auto j = std::lower_bound (window_numbers.begin (), window_numbers.end (), i);
+        assert (j != window_numbers.end () && *j == i);
+        return j - window_numbers.begin ();
+    }
+    // Get the sorted elevations in row 'i'
+    std::span<const double> operator[] (const size_t i) const
+    {
+        assert (i < sizes.size ());
+        return std::span<const double> (elevations.values.data () + elevations.offsets[i], sizes[i]);
+    }
+};
+
+template<typename T>
+sorted_windows get_sorted_windows (const T &samples, const double window_size)
+{
+    using namespace std;
+
+    sorted_windows w;
+    w.window_size = window_size;
+    if (samples.empty ())
+        return w;
+
+    w.window_indexes = get_window_indexes (samples, window_size);
+    w.window_numbers = get_occupied_windows (w.window_indexes);
+
+    // Get each sample's row
+    const size_t rows = w.window_numbers.size ();
+    vector<size_t> sample_rows (samples.size ());
+
+#pragma omp parallel for
+    for (size_t i = 0; i < sample_rows.size (); ++i)
+        sample_rows[i] = w.get_row (w.window_indexes[i]);
+
+    // Sort each window's in range elevations
+    w.elevations = get_window_elevations (samples, sample_rows, 0, rows);
+    w.sizes.resize (rows);
+
+#pragma omp parallel
+    {
+        detail::sort_buffers b;
+
+#pragma omp for
+        for (size_t i = 0; i < rows; ++i)
+        {
+            const auto e = w.elevations[i];
+            w.sizes[i] = detail::keep_in_range (e);
+            detail::sort_values (e.data (), w.sizes[i], b);
+        }
+    }
+
+    return w;
+}
+
+template<typename T>
+class features
+{
+    public:
+    features (const T &init_samples, const feature_params &init_fp)
+        : samples (init_samples)
+        , fp (init_fp)
+        , first_window (0)
+    {
+        using namespace std;
+
+        const auto window_indexes = get_window_indexes (samples, fp.window_size);
+        last_window = window_indexes.empty ()
+            ? 0
+            : *max_element (window_indexes.begin (), window_indexes.end ()) + 1;
+        total_windows = last_window;
+        init (window_indexes);
+    }
+    // Get features for the samples in 'selected' only
+    //
+    // Only the windows that their features are computed from are
+    // created, and only their features can be written.
+    features (const T &init_samples,
+        const feature_params &init_fp,
+        const std::vector<size_t> &selected)
+        : samples (init_samples)
+        , fp (init_fp)
+        , first_window (0)
+    {
+        using namespace std;
+
+        const auto window_indexes = get_window_indexes (samples, fp.window_size);
+        last_window = window_indexes.empty ()
+            ? 0
+            : *max_element (window_indexes.begin (), window_indexes.end ()) + 1;
+        total_windows = last_window;
+        init (window_indexes, &selected);
+    }
+    // Get features for the samples in 'selected' only, using the sorted
+    // windows in 'w'
+    //
+    // 'w' must have been created from 'init_samples' with the same window
+    // size. Only the quantiles are computed, without sorting again.
+    features (const T &init_samples,
+        const feature_params &init_fp,
+        const std::vector<size_t> &selected,
+        const sorted_windows &w)
+        : samples (init_samples)
+        , fp (init_fp)
+        , first_window (0)
+        , last_window (w.total_windows ())
+        , total_windows (w.total_windows ())
+    {
+        assert (w.window_size == fp.window_size);
+        init (w.window_indexes, &selected, &w);
+    }
+    // Get features for a subset of a track
+    //
+    // 'init_window_indexes' are the samples' window indexes within the
+    // whole track, which has 'init_total_windows' windows. Windows
+    // [init_first_window, init_last_window) must contain every window
+    // that the samples' features are computed from.
+    features (const T &init_samples,
+        const feature_params &init_fp,
+        const std::vector<size_t> &init_window_indexes,
+        const size_t init_first_window,
+        const size_t init_last_window,
+        const size_t init_total_windows)
+        : samples (init_samples)
+        , fp (init_fp)
+        , first_window (init_first_window)
+        , last_window (init_last_window)
+        , total_windows (init_total_windows)
+    {
+        assert (init_first_window <= init_last_window);
+        assert (init_last_window <= init_total_windows);
+        init (init_window_indexes);
+    }
+    size_t features_per_sample () const
+    {
+        return get_features_per_sample (fp);
+    }
+    // Number of samples
+    size_t size () const
+    {
+        return window_rows.size ();
+    }
+    // Are the rows written by the writer that is specialized for the
+    // default feature parameters?
+    bool uses_default_row_writer () const
+    {
+        constexpr feature_params defaults;
+        return fp.total_quantiles == defaults.total_quantiles
+            && fp.adjacent_windows == defaults.adjacent_windows;
+    }
+    // Number of windows whose quantiles are stored
+    size_t occupied_windows () const
+    {
+        return window_numbers.size ();
+    }
+    std::vector<float> get_features (const size_t n) const
+    {
+        std::vector<float> f (features_per_sample ());
+        write_features (n, f.data ());
+        return f;
+    }
+    // Write the features for sample 'n' into 'row', which must have room
+    // for features_per_sample () values
+    //
+    // Returns a pointer past the last value written.
+    float *write_features (const size_t n, float *row) const
+    {
+        float *end = row;
+        with_row_writer ([&] (const auto write_row) { end = write_row (n, row); });
+        return end;
+    }
+    // Write the features for samples [begin, end) into 'matrix', one row
+    // per sample, in parallel
+    void write_features (const size_t begin, const size_t end, float *matrix) const
+    {
+        const size_t cols = features_per_sample ();
+
+        with_row_writer ([&] (const auto write_row)
+        {
+#pragma omp parallel for
+            for (size_t n = begin; n < end; ++n)
+                write_row (n, matrix + (n - begin) * cols);
+        });
+    }
+    // Write the features for samples 'indexes[0]', 'indexes[1]', ... into
+    // 'matrix', one row per sample, in parallel
+    template<typename I>
+    void write_features (const I &indexes, float *matrix) const
+    {
+        const size_t cols = features_per_sample ();
+
+        with_row_writer ([&] (const auto write_row)
+        {
+#pragma omp parallel for
+            for (size_t i = 0; i < indexes.size (); ++i)
+                write_row (indexes[i], matrix + i * cols);
+        });
+    }
+    private:
+    // The features are stored factored: each window's quantiles are
+    // stored once, and each sample only has its elevation and the row of
+    // its window. Rows of features are only created when they are
+    // written.
+    //
+    // Only windows that have samples in them get a row, so the memory
+    // used depends on the number of samples, not on the length of the
+    // track.
+    const T &samples;
+    feature_params fp;
+    size_t first_window;
+    size_t last_window;
+    size_t total_windows;
+    // Track index of the window in each row, in ascending order
+    std::vector<size_t> window_numbers;
+    // Track indexes of all windows that have samples in them, if only
+    // some of them have rows
+    std::vector<size_t> occupied_numbers;
+    // Row of each sample's window
+    std::vector<size_t> window_rows;
+    // Rows of each row's adjacent windows
+    std::vector<size_t> adjacent_rows;
+    // One row of quantiles per window, followed by a row of zeros for
+    // windows without samples
+    feature_matrix window_quantiles;
+    // One table of quantiles for each pyramid level, with one row per
+    // window
+    std::vector<feature_matrix> pyramid_quantiles;
+    // Row of each row's window at each pyramid level
+    std::vector<size_t> pyramid_rows;
+    // Elevation, density, and window index of each sample
+    std::vector<ATL24_qtrees::features::photon_features> photons;
+    // The tables that were computed. The features from the others are
+    // written as missing data.
+    feature_tables tables;
+
+    // The window is not on the track
+    static constexpr size_t missing_row = std::numeric_limits<size_t>::max ();
+    // The window is not in [first_window, last_window)
+    static constexpr size_t unknown_row = missing_row - 1;
+
+    // Create the windows
+    //
+    // If 'selected' is specified, only create the windows that the
+    // features of the samples in 'selected' are computed from. If
+    // 'sorted' is specified, get the windows' elevations from it.
+    void init (const std::vector<size_t> &window_indexes,
+        const std::vector<size_t> *selected = nullptr,
+        const sorted_windows *sorted = nullptr)
+    {
+        using namespace std;
+
+        // Check invariants
+        assert (window_indexes.size () == samples.size ());
+        assert (is_sorted (fp.used_features.begin (), fp.used_features.end ()));
+        assert (fp.used_features.empty () || fp.used_features.back () < features_per_sample ());
+
+        // Get the windows that have samples in them
+        window_numbers = sorted != nullptr
+            ? sorted->window_numbers
+            : get_occupied_windows (window_indexes);
+
+        if (selected != nullptr)
+        {
+            // Get the selected samples' windows and their adjacent
+            // windows
+            vector<size_t> needed;
+            needed.reserve (selected->size () * (2 * fp.adjacent_windows + 1));
+            for (const auto i : *selected)
+            {
+                assert (i < window_indexes.size ());
+                const size_t w = window_indexes[i];
+                for (size_t j = w - std::min (w, fp.adjacent_windows); j <= w + fp.adjacent_windows; ++j)
+                    needed.push_back (j);
+
+                // The pyramid needs all of the windows under the
+                // photon's window at the top level
+                const size_t top = w >> fp.pyramid_levels;
+                for (size_t j = top << fp.pyramid_levels; j < (top + 1) << fp.pyramid_levels; ++j)
+                    needed.push_back (j);
+            }
+            sort (needed.begin (), needed.end ());
+            needed.erase (unique (needed.begin (), needed.end ()), needed.end ());
+
+            // Only keep the needed windows
+            occupied_numbers = std::move (window_numbers);
+            window_numbers.clear ();
+            set_intersection (occupied_numbers.begin (), occupied_numbers.end (),
+                needed.begin (), needed.end (),
+                back_inserter (window_numbers));
+        }
+
+        const size_t rows = window_numbers.size ();
+
+        // Get the row of each sample's window. Samples in windows that
+        // are not needed don't have one.
+        window_rows.resize (samples.size ());
+
+#pragma omp parallel for
+        for (size_t i = 0; i < window_rows.size (); ++i)
+        {
+            window_rows[i] = get_row (window_indexes[i]);
+            assert (window_rows[i] < rows || (selected != nullptr && window_rows[i] == unknown_row));
+        }
+
+        // Only compute the tables that the used features are read from
+        const size_t nq = fp.total_quantiles;
+        const size_t na = 2 * fp.adjacent_windows;
+        tables = get_feature_tables (fp);
+
+        // Get the sorted, in range elevations in each window
+        vector<span<const double>> sorted_rows (rows);
+        window_elevations elevations;
+
+        const bool use_elevations = tables.windows || tables.pyramid;
+
+        if (use_elevations && sorted != nullptr)
+        {
+#pragma omp parallel for
+            for (size_t i = 0; i < rows; ++i)
+                sorted_rows[i] = (*sorted)[sorted->get_row (window_numbers[i])];
+        }
+        else if (use_elevations)
+        {
+            elevations = get_window_elevations (samples, window_rows, 0, rows);
+
+#pragma omp parallel
+            {
+                detail::sort_buffers b;
+
+#pragma omp for
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    const auto e = elevations[i];
+                    const size_t n = detail::keep_in_range (e);
+                    detail::sort_values (e.data (), n, b);
+                    sorted_rows[i] = e.first (n);
+                }
+            }
+        }
+
+        // Get the quantiles in each window
+        if (tables.windows)
+        {
+            window_quantiles = feature_matrix ((rows + 1) * nq);
+
+#pragma omp parallel
+            {
+                detail::sort_buffers b;
+
+#pragma omp for
+                for (size_t i = 0; i < rows; ++i)
+                {
+                    const auto q = get_sorted_quantiles (sorted_rows[i], nq, b);
+                    copy (q.begin (), q.end (), window_quantiles.begin () + i * nq);
+                }
+            }
+
+            // Windows without samples have quantiles of zero
+            fill_n (window_quantiles.begin () + rows * nq, nq, 0.0f);
+        }
+
+        // Get the quantiles in the pyramid
+        if (tables.pyramid)
+            init_pyramid (std::move (sorted_rows));
+
+        // Get the densities
+        if (tables.density)
+            photons = get_photon_features (samples, fp, window_indexes, selected);
+
+        // Get the rows of the adjacent windows
+        adjacent_rows.resize (rows * na);
+
+#pragma omp parallel for
+        for (size_t i = 0; i < rows; ++i)
+        {
+            const size_t w = window_numbers[i];
+            for (size_t j = 0; j < fp.adjacent_windows; ++j)
+            {
+                adjacent_rows[i * na + 2 * j] = get_row (w + (j + 1));
+                adjacent_rows[i * na + 2 * j + 1] = get_row (w - (j + 1));
+            }
+        }
+    }
+    // Create the pyramid levels from the sorted elevations in each
+    // window
+    //
+    // The elevations in each window of a level are the elevations in
+    // its two windows on the level below, which are already sorted, so
+    // they only have to be merged.
+    void init_pyramid (std::vector<std::span<const double>> level)
     {
-        default: return 0;
-        case 1: return 40;
-        case 2: return 41;
+        using namespace std;
+
+        const size_t levels = fp.pyramid_levels;
+        const size_t rows = window_numbers.size ();
+        const size_t nq = fp.total_quantiles;
+
+        pyramid_quantiles.resize (levels);
+        pyramid_rows.resize (rows * levels);
+
+        // Window index of each window on the current level, and the
+        // window that each row is in on the current level
+        vector<size_t> numbers (window_numbers);
+        vector<size_t> parents (rows);
+        iota (parents.begin (), parents.end (), 0);
+
+        // The merged elevations on the current level
+        vector<double> values;
+
+        for (size_t l = 0; l < levels; ++l)
+        {
+            // Get the first of the windows that make up each window on
+            // the next level
+            vector<size_t> first;
+            for (size_t i = 0; i < numbers.size (); ++i)
+                if (i == 0 || (numbers[i] >> 1) != (numbers[i - 1] >> 1))
+                    first.push_back (i);
+            first.push_back (numbers.size ());
+
+            const size_t total = first.size () - 1;
+
+            // Get where each window's elevations go
+            vector<size_t> offsets (total + 1);
+            for (size_t k = 0; k < total; ++k)
+            {
+                offsets[k + 1] = offsets[k];
+                for (size_t i = first[k]; i < first[k + 1]; ++i)
+                    offsets[k + 1] += level[i].size ();
+            }
+
+            // Merge them and get the quantiles
+            vector<double> merged (offsets.back ());
+            vector<span<const double>> next (total);
+            pyramid_quantiles[l] = feature_matrix (total * nq);
+
+#pragma omp parallel
+            {
+                detail::sort_buffers b;
+
+#pragma omp for
+                for (size_t k = 0; k < total; ++k)
+                {
+                    double *out = merged.data () + offsets[k];
+                    const size_t i = first[k];
+                    if (first[k + 1] - i == 2)
+                        std::merge (level[i].begin (), level[i].end (), level[i + 1].begin (), level[i + 1].end (), out);
+                    else
+                        std::copy (level[i].begin (), level[i].end (), out);
+
+                    next[k] = span<const double> (out, offsets[k + 1] - offsets[k]);
+
+                    const auto q = get_sorted_quantiles (next[k], nq, b);
+                    std::copy (q.begin (), q.end (), pyramid_quantiles[l].begin () + k * nq);
+                }
+            }
+
+            // Get the window that each row is in on the next level
+            vector<size_t> next_numbers (total);
+            vector<size_t> next_parents (numbers.size ());
+            for (size_t k = 0; k < total; ++k)
+            {
+                next_numbers[k] = numbers[first[k]] >> 1;
+                for (size_t i = first[k]; i < first[k + 1]; ++i)
+                    next_parents[i] = k;
+            }
+
+            for (size_t i = 0; i < rows; ++i)
+            {
+                parents[i] = next_parents[parents[i]];
+                pyramid_rows[i * levels + l] = parents[i];
+            }
+
+            numbers = std::move (next_numbers);
+            level = std::move (next);
+            values = std::move (merged);
+        }
     }
-}
+    // Get the row of the window with track index 'i'
+    size_t get_row (const size_t i) const
+    {
+        using namespace std;
 
-struct window
-{
-    std::vector<double> quantiles;
-};
+        // Indexes before the start of the track wrap around
+        if (i >= total_windows)
+            return missing_row;
 
-template<typename T>
-std::vector<size_t> get_window_indexes (const T &samples, const double &window_size)
-{
-    using namespace std;
+        if (i < first_window || i >= last_window)
+            return unknown_row;
 
-    const double min_x = min_element (samples.cbegin (), samples.cend (),
-        [] (const auto &a, const auto &b) { return a.x < b.x; })->x;
+        const auto j = lower_bound (window_numbers.begin (), window_numbers.end (), i);
 
-    // Get the index for each photon
-    std::vector<size_t> indexes (samples.size ());
+        if (j == window_numbers.end () || *j != i)
+        {
+            // The window has samples, but it wasn't created
+            if (binary_search (occupied_numbers.begin (), occupied_numbers.end (), i))
+                return unknown_row;
 
-#pragma omp parallel for
-    for (size_t i = 0; i < samples.size (); ++i)
+            // Use the row of zeros if the window has no samples
+            return window_numbers.size ();
+        }
+
+        return j - window_numbers.begin ();
+    }
+    const float *get_window_quantiles (const size_t r) const
     {
-        // What is the photon's window index?
-        const size_t index = (samples[i].x - min_x) / window_size;
-        indexes[i] = index;
+        assert (r != unknown_row);
+        assert (r <= window_numbers.size ());
+        return window_quantiles.data () + r * fp.total_quantiles;
     }
+    // Write the features for sample 'n' into 'row'
+    //
+    // If 'NQ' and 'NA' are not 0, they must be equal to the number of
+    // quantiles and adjacent windows, and the rows are written with
+    // fixed length copies.
+    template<size_t NQ,size_t NA>
+    float *write_row (const size_t n, float *row) const
+    {
+        using namespace std;
+        using namespace constants;
 
-    return indexes;
-}
+        const size_t nq = NQ != 0 ? NQ : fp.total_quantiles;
+        const size_t na = 2 * (NA != 0 ? NA : fp.adjacent_windows);
 
-template<typename T,typename U>
-std::vector<double> get_quantiles (T x, const U &fp)
-{
-    using namespace std;
+        // Check invariants
+        assert (nq == fp.total_quantiles);
+        assert (na == 2 * fp.adjacent_windows);
+        assert (n < window_rows.size ());
+        assert (window_rows[n] < window_numbers.size ());
 
-    vector<double> q (fp.total_quantiles);
-    if (x.size () < fp.total_quantiles)
-        return q;
+        float *f = row;
 
-    // Order them
-    sort (x.begin (), x.end ());
+        // Elevation
+        *f++ = samples[n].z;
 
-    // Count number in each quantile
-    vector<size_t> total (fp.total_quantiles);
+        // Quantiles for the photon's window
+        const size_t r = window_rows[n];
+        if (tables.windows)
+        {
+            f = copy_n (get_window_quantiles (r), nq, f);
+
+            // Quantiles for adjacent windows, alternating between the
+            // right and the left
+            for (size_t j = 0; j < na; ++j)
+            {
+                const size_t k = adjacent_rows[r * na + j];
+                if (k == missing_row)
+                    f = fill_n (f, nq, missing_data);
+                else
+                    f = copy_n (get_window_quantiles (k), nq, f);
+            }
+        }
+        else
+            f = fill_n (f, (na + 1) * nq, missing_data);
 
-    const double photons_per_quantile = static_cast<double> (x.size ()) / fp.total_quantiles;
+        // Quantiles for the photon's windows in the pyramid
+        const size_t levels = fp.pyramid_levels;
+        if (tables.pyramid)
+        {
+            for (size_t l = 0; l < levels; ++l)
+                f = copy_n (pyramid_quantiles[l].data () + pyramid_rows[r * levels + l] * nq, nq, f);
+        }
+        else
+            f = fill_n (f, levels * nq, missing_data);
 
-    for (size_t i = 0; i < x.size (); ++i)
-    {
-        const size_t index = i / photons_per_quantile;
+        // Photon density
+        if (fp.density)
+            *f++ = tables.density ? photons[n].density : missing_data;
 
-        assert (index < q.size ());
-        assert (index < total.size ());
+        // Check invariants
+        assert (static_cast<size_t> (f - row) == features_per_sample ());
 
-        q[index] += x[i];
-        ++total[index];
+        return f;
     }
+    // Call 'f' with a function that writes a row of features
+    //
+    // The default feature parameters get a row writer that is
+    // specialized for them. Other parameters get the generic one.
+    template<typename F>
+    void with_row_writer (F f) const
+    {
+        constexpr feature_params defaults;
+        constexpr size_t nq = defaults.total_quantiles;
+        constexpr size_t na = defaults.adjacent_windows;
+
+        if (uses_default_row_writer ())
+            f ([this] (const size_t n, float *row) { return write_row<nq, na> (n, row); });
+        else
+            f ([this] (const size_t n, float *row) { return write_row<0, 0> (n, row); });
+    }
+};
 
-    // Get the quantile's average value
-    for (size_t i = 0; i < q.size (); ++i)
-        q[i] /= total[i];
-
-    return q;
-}
-
-template<typename T,typename U>
-window create_window (const T &elevations, const U &fp)
+// Get the index of the first sample in each dataset, followed by the
+// total number of samples
+//
+// Samples with the same 'dataset_id' must be next to each other in
+// 'samples'.
+template<typename T>
+std::vector<size_t> get_dataset_offsets (const T &samples)
 {
     using namespace std;
 
-    // Throw out elevations that are out of range
-    T e;
-    copy_if (elevations.begin (), elevations.end (), back_inserter (e),
-            [](double x) {
-                return x > constants::min_photon_elevation
-                         && x < constants::max_photon_elevation;
-            });
+    vector<size_t> offsets;
+    for (size_t i = 0; i < samples.size (); ++i)
+        if (i == 0 || samples[i].dataset_id != samples[i - 1].dataset_id)
+            offsets.push_back (i);
+    offsets.push_back (samples.size ());
+
+    // Check invariants
+    unordered_set<size_t> ids;
+    for (size_t i = 0; i + 1 < offsets.size (); ++i)
+        if (!ids.insert (samples[offsets[i]].dataset_id).second)
+            throw runtime_error ("The samples in each dataset must be contiguous");
 
-    return window {get_quantiles (e, fp)};
+    return offsets;
 }
 
-template<typename T,typename U,typename V>
-std::vector<window> get_windows (const T &samples,
-    const U &fp,
-    const V &window_indexes)
+// Sorted windows for each dataset
+struct dataset_windows
 {
-    using namespace std;
+    std::vector<size_t> offsets;
+    std::vector<sorted_windows> windows;
+};
 
-    // Check logic
-    assert (samples.size () == window_indexes.size ());
+template<typename T>
+dataset_windows get_dataset_windows (const T &samples, const double window_size)
+{
+    using namespace std;
+    using value_type = typename T::value_type;
 
-    // Get the min/max x for all samples
-    const size_t max_index = *max_element (window_indexes.begin (), window_indexes.end ());
-    const size_t n = max_index + 1;
+    dataset_windows w;
+    w.offsets = get_dataset_offsets (samples);
+    w.windows.resize (w.offsets.size () - 1);
 
-    // Get the elevations in each window
-    std::vector<std::vector<double>> elevations (n);
+    const int max_threads = omp_get_max_threads ();
 
-    for (size_t i = 0; i < samples.size (); ++i)
+#pragma omp parallel for schedule(dynamic) if (static_cast<int> (w.windows.size ()) >= max_threads)
+    for (size_t i = 0; i < w.windows.size (); ++i)
     {
-        const size_t index = (window_indexes[i]);
-        assert (index < elevations.size ());
-        elevations[index].push_back (samples[i].z);
+        const span<const value_type> dataset (samples.data () + w.offsets[i], w.offsets[i + 1] - w.offsets[i]);
+        w.windows[i] = get_sorted_windows (dataset, window_size);
     }
 
-    std::vector<window> w (n);
-
-#pragma omp parallel for
-    for (size_t i = 0; i < w.size (); ++i)
-        w[i] = create_window (elevations[i], fp);
-
     return w;
 }
 
+// Features for samples from several datasets
+//
+// Each dataset's features are computed separately, so windows only
+// contain photons from their own dataset. Samples with the same
+// 'dataset_id' must be next to each other in 'samples'.
 template<typename T>
-class features
+class dataset_features
 {
     public:
-    features (const T &init_samples, const feature_params &init_fp)
-        : samples (init_samples)
-        , fp (init_fp)
-        , window_indexes (get_window_indexes (init_samples, init_fp.window_size))
-        , windows (get_windows (init_samples, init_fp, window_indexes))
+    using value_type = typename T::value_type;
+    using dataset_type = std::span<const value_type>;
+
+    dataset_features (const T &samples, const feature_params &init_fp)
+        : fp (init_fp)
     {
-        assert (window_indexes.size () == samples.size ());
+        init (samples, nullptr);
+    }
+    // Get features for the samples in 'selected' only
+    //
+    // Only the windows that their features are computed from are
+    // created, and only their features can be written.
+    dataset_features (const T &samples,
+        const feature_params &init_fp,
+        const std::vector<size_t> &selected)
+        : fp (init_fp)
+    {
+        init (samples, &selected);
+    }
+    // Get features for the samples in 'selected' only, using the sorted
+    // windows in 'w'
+    //
+    // 'w' must have been created from 'samples' with the same window
+    // size.
+    dataset_features (const T &samples,
+        const feature_params &init_fp,
+        const std::vector<size_t> &selected,
+        const dataset_windows &w)
+        : fp (init_fp)
+    {
+        init (samples, &selected, &w);
     }
     size_t features_per_sample () const
     {
-        // total features =
-        //        photon elevation
-        //      + quantiles in photon's window
-        //      + quantiles in adjacent windows
-        return    1
-                + fp.total_quantiles
-                + (2 * fp.adjacent_windows) * fp.total_quantiles;
+        return get_features_per_sample (fp);
+    }
+    // Number of samples
+    size_t size () const
+    {
+        return offsets.back ();
+    }
+    // Number of datasets
+    size_t total_datasets () const
+    {
+        return datasets.size ();
     }
     std::vector<float> get_features (const size_t n) const
+    {
+        std::vector<float> row (features_per_sample ());
+        write_features (n, row.data ());
+        return row;
+    }
+    // Write the features for sample 'n' into 'row'
+    //
+    // Returns a pointer past the last value written.
+    float *write_features (const size_t n, float *row) const
     {
         using namespace std;
-        using namespace constants;
 
         // Check invariants
-        assert (n < window_indexes.size ());
+        assert (n < size ());
 
-        // Get the features for this photon
-        vector<float> f; f.reserve (features_per_sample ());
+        // Get the sample's dataset
+        const size_t i = get_dataset (n);
+        assert (i < f.size ());
 
-        // Elevation
-        f.push_back (samples[n].z);
+        return f[i]->write_features (n - offsets[i], row);
+    }
+    // Write the features for samples 'indexes[0]', 'indexes[1]', ... into
+    // 'matrix', one row per sample, in parallel
+    template<typename I>
+    void write_features (const I &indexes, float *matrix) const
+    {
+        const size_t cols = features_per_sample ();
 
-        // Quantiles for the photon's window
-        const size_t i = window_indexes[n];
-        f.insert (f.end (), windows[i].quantiles.begin (), windows[i].quantiles.end ());
+#pragma omp parallel for
+        for (size_t i = 0; i < indexes.size (); ++i)
+            write_features (indexes[i], matrix + i * cols);
+    }
 
-        // Quantiles for adjacent windows
-        for (size_t j = 0; j < fp.adjacent_windows; ++j)
-        {
-            // Push window on the right
-            const size_t right_index = i + (j + 1);
-            if (right_index < windows.size ())
-                f.insert (f.end (), windows[right_index].quantiles.begin (), windows[right_index].quantiles.end ());
-            else
-                f.insert (f.end (), windows[i].quantiles.size (), missing_data);
+    private:
+    feature_params fp;
+    std::vector<size_t> offsets;
+    // The features refer to these, so they must not be reallocated after
+    // the features are created
+    std::vector<dataset_type> datasets;
+    std::vector<std::unique_ptr<features<dataset_type>>> f;
+
+    void init (const T &samples,
+        const std::vector<size_t> *selected,
+        const dataset_windows *w = nullptr)
+    {
+        using namespace std;
 
-            // Push window on the left
-            const size_t left_index = i - (j + 1);
-            if (left_index < windows.size ())
-                f.insert (f.end (), windows[left_index].quantiles.begin (), windows[left_index].quantiles.end ());
-            else
-                f.insert (f.end (), windows[i].quantiles.size (), missing_data);
-        }
+        // Get the first sample in each dataset
+        offsets = get_dataset_offsets (samples);
 
         // Check invariants
-        assert (f.size () == features_per_sample ());
+        assert (w == nullptr || w->offsets == offsets);
 
-        return f;
+        for (size_t i = 0; i + 1 < offsets.size (); ++i)
+            datasets.emplace_back (samples.data () + offsets[i], offsets[i + 1] - offsets[i]);
+
+        // Get the selected samples in each dataset
+        vector<vector<size_t>> dataset_selected (datasets.size ());
+        if (selected != nullptr)
+        {
+            for (const auto n : *selected)
+            {
+                const size_t i = get_dataset (n);
+                dataset_selected[i].push_back (n - offsets[i]);
+            }
+        }
+
+        // Create the features for each dataset. If there are enough
+        // datasets to keep every thread busy, create them in parallel.
+        // Otherwise, each one is created in parallel.
+        f.resize (datasets.size ());
+
+        const int max_threads = omp_get_max_threads ();
+
+#pragma omp parallel for schedule(dynamic) if (static_cast<int> (datasets.size ()) >= max_threads)
+        for (size_t i = 0; i < datasets.size (); ++i)
+        {
+            if (selected == nullptr)
+                f[i] = make_unique<features<dataset_type>> (datasets[i], fp);
+            else if (w == nullptr)
+                f[i] = make_unique<features<dataset_type>> (datasets[i], fp, dataset_selected[i]);
+            else
+                f[i] = make_unique<features<dataset_type>> (datasets[i], fp, dataset_selected[i], w->windows[i]);
+        }
+    }
+    // Get the index of the dataset that contains sample 'n'
+    size_t get_dataset (const size_t n) const
+    {
+        assert (n < offsets.back ());
+        return std::upper_bound (offsets.begin (), offsets.end (), n) - offsets.begin () - 1;
     }
-    private:
-    const std::vector<sample> &samples;
-    feature_params fp;
-    std::vector<size_t> window_indexes;
-    std::vector<window> windows;
 };
 
 template<typename T>
@@ -295,107 +1681,148 @@ std::vector<sample> convert_dataframe (const T &df)
     const size_t nrows = df.columns[0].size ();
 
     // Get the columns we are interested in
-    auto pi_it = find (df.headers.begin(), df.headers.end(), pi_name);
-    auto x_it = find (df.headers.begin(), df.headers.end(), x_name);
-    auto z_it = find (df.headers.begin(), df.headers.end(), z_name);
-    auto cls_it = find (df.headers.begin(), df.headers.end(), "manual_label");
-    auto prediction_it = find (df.headers.begin(), df.headers.end(), "prediction");
-    auto surface_elevation_it = find (df.headers.begin(), df.headers.end(), "sea_surface_h");
-    auto bathy_elevation_it = find (df.headers.begin(), df.headers.end(), "bathy_h");
-
-    assert (pi_it != df.headers.end ());
-    assert (x_it != df.headers.end ());
-    assert (z_it != df.headers.end ());
-
-    if (pi_it == df.headers.end ())
+    if (!df.has_column (pi_name))
         throw runtime_error ("Can't find 'index_ph' in dataframe");
-    if (x_it == df.headers.end ())
+    if (!df.has_column (x_name))
         throw runtime_error ("Can't find 'x_atc' in dataframe");
-    if (z_it == df.headers.end ())
+    if (!df.has_column (z_name))
         throw runtime_error ("Can't find 'geoid_corr_h' in dataframe");
 
-    size_t index_ph = pi_it - df.headers.begin();
-    size_t x_index = x_it - df.headers.begin();
-    size_t z_index = z_it - df.headers.begin();
-    const bool has_manual_label = cls_it != df.headers.end ();
-    size_t cls_index = has_manual_label ?
-        cls_it - df.headers.begin() :
-        df.headers.size ();
-    const bool has_predictions = prediction_it != df.headers.end ();
-    size_t prediction_index = has_predictions ?
-        prediction_it - df.headers.begin() :
-        df.headers.size ();
-    const bool has_surface_elevations = surface_elevation_it != df.headers.end ();
-    size_t surface_elevation_index = has_surface_elevations ?
-        surface_elevation_it - df.headers.begin() :
-        df.headers.size ();
-    const bool has_bathy_elevations = bathy_elevation_it != df.headers.end ();
-    size_t bathy_elevation_index = has_bathy_elevations ?
-        bathy_elevation_it - df.headers.begin() :
-        df.headers.size ();
-
-    // Check logic
-    assert (index_ph < df.headers.size ());
-    assert (x_index < df.headers.size ());
-    assert (z_index < df.headers.size ());
-    if (has_manual_label)
-        assert (cls_index < df.headers.size ());
-    if (has_predictions)
-        assert (prediction_index < df.headers.size ());
-    if (has_surface_elevations)
-        assert (surface_elevation_index < df.headers.size ());
-    if (has_bathy_elevations)
-        assert (bathy_elevation_index < df.headers.size ());
-
-    assert (index_ph < df.columns.size ());
-    assert (x_index < df.columns.size ());
-    assert (z_index < df.columns.size ());
-    if (has_manual_label)
-        assert (cls_index < df.columns.size ());
-    if (has_predictions)
-        assert (prediction_index < df.columns.size ());
-    if (has_surface_elevations)
-        assert (surface_elevation_index < df.columns.size ());
-    if (has_bathy_elevations)
-        assert (bathy_elevation_index < df.columns.size ());
-
     // Stuff values into the vector
     std::vector<sample> dataset (nrows);
 
-    for (size_t j = 0; j < nrows; ++j)
+    // Copy a column using its own value type
+    const auto copy_column = [&] (const std::string &name, const auto assign)
     {
-        // Check logic
-        assert (j < df.columns[index_ph].size ());
-        assert (j < df.columns[x_index].size ());
-        assert (j < df.columns[z_index].size ());
-        if (has_manual_label)
-            assert (j < df.columns[cls_index].size ());
-        if (has_predictions)
-            assert (j < df.columns[prediction_index].size ());
-        if (has_surface_elevations)
-            assert (j < df.columns[surface_elevation_index].size ());
-        if (has_bathy_elevations)
-            assert (j < df.columns[bathy_elevation_index].size ());
-
-        // Make assignments
-        dataset[j].h5_index = df.columns[index_ph][j];
-        dataset[j].x = df.columns[x_index][j];
-        dataset[j].z = df.columns[z_index][j];
-        if (has_manual_label)
-            dataset[j].cls = df.columns[cls_index][j];
-        if (has_predictions)
-            dataset[j].prediction = df.columns[prediction_index][j];
-        if (has_surface_elevations)
-            dataset[j].surface_elevation = df.columns[surface_elevation_index][j];
-        if (has_bathy_elevations)
-            dataset[j].bathy_elevation = df.columns[bathy_elevation_index][j];
-    }
+        if (!df.has_column (name))
+            return;
+
+        ATL24_qtrees::dataframe::visit_column (df[df.get_handle (name)], [&] (const auto &c)
+        {
+            assert (c.size () == nrows);
+#pragma omp parallel for
+            for (size_t j = 0; j < nrows; ++j)
+                assign (dataset[j], c[j]);
+        });
+    };
+
+    // Make assignments
+    copy_column (pi_name, [] (sample &s, const auto x) { s.h5_index = x; });
+    copy_column (x_name, [] (sample &s, const auto x) { s.x = x; });
+    copy_column (z_name, [] (sample &s, const auto x) { s.z = x; });
+    copy_column ("manual_label", [] (sample &s, const auto x) { s.cls = x; });
+    copy_column ("prediction", [] (sample &s, const auto x) { s.prediction = x; });
+    copy_column ("sea_surface_h", [] (sample &s, const auto x) { s.surface_elevation = x; });
+    copy_column ("bathy_h", [] (sample &s, const auto x) { s.bathy_elevation = x; });
 
     return dataset;
 }
 
+// The headers of a CSV file and the start of each of its rows
+//
+// The input values are not stored. They are parsed again from the file
+// when they are written.
+struct csv_rows
+{
+    std::shared_ptr<const ATL24_qtrees::dataframe::mapped_file> file;
+    ATL24_qtrees::dataframe::header_list headers;
+    std::vector<const char *> lines;
+    size_t rows () const
+    {
+        return lines.size ();
+    }
+};
+
+// Can samples be read directly from 'f' with read_samples ()?
+inline bool is_csv (const ATL24_qtrees::dataframe::mapped_file &f)
+{
+    return !columnar::is_columnar (f)
+        && compression::detect (f.data (), f.size ()) == compression::format::none;
+}
+
+// Parse the CSV file 'file' directly into samples, without creating a
+// dataframe
+//
+// The input rows are saved in 'input' so that write_samples () can write
+// them along with the results.
+inline std::vector<sample> read_samples (
+    const std::shared_ptr<const ATL24_qtrees::dataframe::mapped_file> &file,
+    csv_rows &input)
+{
+    using namespace std;
+    using namespace ATL24_qtrees::dataframe::detail;
+
+    if (!is_csv (*file))
+        throw runtime_error ("Samples can only be read directly from uncompressed CSV files");
+
+    const char *begin = file->data ();
+    const char *end = begin + file->size ();
+
+    input.file = file;
+    input.headers.clear ();
+    input.lines.clear ();
+
+    vector<string> headers;
+    const char *p = begin == end ? end : parse_headers (begin, end, headers);
+    for (const auto &h : headers)
+        input.headers.push_back (h);
+
+    if (input.headers.find (pi_name) == input.headers.size ())
+        throw runtime_error ("Can't find 'index_ph' in dataframe");
+    if (input.headers.find (x_name) == input.headers.size ())
+        throw runtime_error ("Can't find 'x_atc' in dataframe");
+    if (input.headers.find (z_name) == input.headers.size ())
+        throw runtime_error ("Can't find 'geoid_corr_h' in dataframe");
+
+    // How to assign each of the sample columns
+    using setter = void (*) (sample &, double);
+    const vector<pair<string, setter>> setters {
+        {pi_name, [] (sample &s, double x) { s.h5_index = x; }},
+        {x_name, [] (sample &s, double x) { s.x = x; }},
+        {z_name, [] (sample &s, double x) { s.z = x; }},
+        {"manual_label", [] (sample &s, double x) { s.cls = x; }},
+        {"prediction", [] (sample &s, double x) { s.prediction = x; }},
+        {"sea_surface_h", [] (sample &s, double x) { s.surface_elevation = x; }},
+        {"bathy_h", [] (sample &s, double x) { s.bathy_elevation = x; }}};
+
+    // Get the fields to parse, in the order in which they appear
+    vector<pair<size_t, setter>> columns;
+    for (const auto &i : setters)
+    {
+        const size_t field = input.headers.find (i.first);
+        if (field != input.headers.size ())
+            columns.emplace_back (field, i.second);
+    }
+    sort (columns.begin (), columns.end (),
+        [] (const auto &a, const auto &b) { return a.first < b.first; });
+
+    vector<size_t> fields;
+    for (const auto &i : columns)
+        fields.push_back (i.first);
+
+    // Parse the rows
+    vector<sample> samples;
+
+    parse_lines (p, end, fields, 0,
+        [&] (const size_t rows)
+        {
+            samples.resize (rows);
+            input.lines.resize (rows);
+        },
+        [&] (const size_t row, const char *line, const vector<double> &values)
+        {
+            input.lines[row] = line;
+            for (size_t i = 0; i < values.size (); ++i)
+                columns[i].second (samples[row], values[i]);
+        });
+
+    return samples;
+}
+
 template<typename T>
-std::vector<sample> read_training_samples (const bool verbose, const T &fns)
+std::vector<sample> read_training_samples (const bool verbose,
+    const T &fns,
+    const bool single_precision = false)
 {
     using namespace std;
     using namespace ATL24_qtrees::dataframe;
@@ -408,23 +1835,26 @@ std::vector<sample> read_training_samples (const bool verbose, const T &fns)
         if (verbose)
             clog << "Reading " << i << ": " << fns[i] << endl;
 
-        const auto df = read (fns[i]);
+        const auto f = make_shared<const mapped_file> (fns[i]);
 
-        if (verbose)
+        auto tmp = columnar::visit (f, [&] (const auto &df)
         {
-            clog << df.rows () << " rows read" << endl;
-            clog << "Total photons = " << df.rows () << endl;
-            clog << "Total dataframe columns = " << df.headers.size () << endl;
-            // Print the columns headers
-            // for (size_t j = 0; j < df.headers.size (); ++j)
-            //     clog << "header[" << j << "]\t\'" << df.headers[j] << "'" << endl;
-        }
-
-        if (!df.has_column ("manual_label"))
-            throw runtime_error ("Can't train without labelled data");
-
-        // Convert them to the correct format
-        auto tmp = convert_dataframe (df);
+            if (verbose)
+            {
+                clog << df.rows () << " rows read" << endl;
+                clog << "Total photons = " << df.rows () << endl;
+                clog << "Total dataframe columns = " << df.headers.size () << endl;
+                // Print the columns headers
+                // for (size_t j = 0; j < df.headers.size (); ++j)
+                //     clog << "header[" << j << "]\t\'" << df.headers[j] << "'" << endl;
+            }
+
+            if (!df.has_column ("manual_label"))
+                throw runtime_error ("Can't train without labelled data");
+
+            // Convert them to the correct format
+            return convert_dataframe (df);
+        }, get_sample_columns (single_precision));
 
         // Set the ID
         for (auto &j : tmp)
@@ -972,16 +2402,18 @@ void check_bathy_estimates (T &samples, size_t &changed)
     changed = tmp;
 }
 
+namespace detail
+{
+
+// Write the columns in 'df', followed by the classification results in
+// 'samples'
 template<typename T,typename U>
-void write_samples (std::ostream &os, T df, const U &samples)
+void write_results (std::ostream &os, T df, const U &samples, const bool binary)
 {
     using namespace std;
 
-    // Check invariants
-    assert (df.rows () == samples.size ());
-
     // Pull data from samples
-    vector<double> p (samples.size ());
+    vector<uint8_t> p (samples.size ());
     vector<double> s (samples.size ());
     vector<double> b (samples.size ());
 
@@ -999,13 +2431,168 @@ void write_samples (std::ostream &os, T df, const U &samples)
     df.headers.push_back ("bathy_h");
 
     // Add new data
-    df.columns.push_back (p);
-    df.columns.push_back (s);
-    df.columns.push_back (b);
+    df.columns.push_back (ATL24_qtrees::dataframe::view (p));
+    df.columns.push_back (ATL24_qtrees::dataframe::view (s));
+    df.columns.push_back (ATL24_qtrees::dataframe::view (b));
     assert (df.is_valid ());
 
     // Write it out
-    write (os, df);
+    if (binary)
+        columnar::write (os, df);
+    else
+        ATL24_qtrees::dataframe::write (os, df);
+}
+
+} // namespace detail
+
+// Write the input columns along with the classification results
+template<typename T,typename U>
+void write_samples (std::ostream &os, const T &input, const U &samples, const bool binary = false)
+{
+    using namespace std;
+
+    // Check invariants
+    assert (input.rows () == samples.size ());
+
+    // Reference the input columns without copying them
+    ATL24_qtrees::dataframe::basic_dataframe<ATL24_qtrees::dataframe::column_view> df;
+    df.headers = input.headers;
+    for (const auto &c : input.columns)
+        df.columns.push_back (ATL24_qtrees::dataframe::view (c));
+
+    detail::write_results (os, df, samples, binary);
+}
+
+// Write the input rows along with the classification results
+template<typename T>
+void write_samples (std::ostream &os, const csv_rows &input, const T &samples, const bool binary = false)
+{
+    using namespace std;
+    using namespace ATL24_qtrees::dataframe::detail;
+
+    // Check invariants
+    assert (input.rows () == samples.size ());
+
+    // The columnar writer needs columns, so parse them
+    if (binary)
+    {
+        const char *begin = input.file->data ();
+        write_samples (os, ATL24_qtrees::dataframe::read (begin, begin + input.file->size ()), samples, true);
+        return;
+    }
+
+    // Print headers
+    string header;
+    for (const auto &h : input.headers)
+        header.append (h).push_back (',');
+    header.append ("prediction,sea_surface_h,bathy_h\n");
+    os.write (header.data (), header.size ());
+
+    // Parse each input row again, and format it the same way
+    // dataframe::write () would
+    const size_t precision = 16;
+    const size_t ncols = input.headers.size ();
+    const char *end = input.file->data () + input.file->size ();
+
+    write_rows (os, samples.size (), [&] (const size_t first, const size_t last, string &buffer)
+    {
+        vector<char> tmp (precision + 320);
+        for (size_t i = first; i < last; ++i)
+        {
+            const char *p = input.lines[i];
+            const char *eol = line_end (p, end);
+            for (size_t j = 0; j < ncols; ++j)
+            {
+                double x;
+                p = parse_field (p, eol, x);
+                format_value (x, precision, tmp, buffer);
+                buffer.push_back (',');
+            }
+            format_value (static_cast<uint8_t> (samples[i].prediction), precision, tmp, buffer);
+            buffer.push_back (',');
+            format_value (samples[i].surface_elevation, precision, tmp, buffer);
+            buffer.push_back (',');
+            format_value (samples[i].bathy_elevation, precision, tmp, buffer);
+            buffer.push_back ('\n');
+        }
+    });
+}
+
+// Only write the photon indexes and the classification results
+//
+// The results can be joined with the input on 'index_ph'.
+template<typename T>
+void write_sidecar (std::ostream &os, const T &samples, const bool binary = false)
+{
+    using namespace std;
+
+    vector<int64_t> h5_indexes (samples.size ());
+
+#pragma omp parallel for
+    for (size_t i = 0; i < samples.size (); ++i)
+        h5_indexes[i] = samples[i].h5_index;
+
+    ATL24_qtrees::dataframe::basic_dataframe<ATL24_qtrees::dataframe::column_view> df;
+    df.headers.push_back (pi_name);
+    df.columns.push_back (ATL24_qtrees::dataframe::view (h5_indexes));
+
+    detail::write_results (os, df, samples, binary);
+}
+
+// Reorder 'x' in place so that x'[i] = x[indexes[i]]
+template<typename T,typename U>
+void gather_in_place (T &x, const U &indexes)
+{
+    assert (x.size () == indexes.size ());
+
+    // Follow each cycle of the permutation
+    std::vector<bool> done (x.size ());
+    for (size_t i = 0; i < x.size (); ++i)
+    {
+        if (done[i])
+            continue;
+        auto tmp = x[i];
+        size_t j = i;
+        while (indexes[j] != i)
+        {
+            assert (indexes[j] < x.size ());
+            x[j] = x[indexes[j]];
+            done[j] = true;
+            j = indexes[j];
+        }
+        x[j] = tmp;
+        done[j] = true;
+    }
+}
+
+// Reorder 'x' in place so that x'[indexes[i]] = x[i]
+//
+// This undoes gather_in_place ().
+template<typename T,typename U>
+void scatter_in_place (T &x, const U &indexes)
+{
+    using std::swap;
+
+    assert (x.size () == indexes.size ());
+
+    // Follow each cycle of the permutation
+    std::vector<bool> done (x.size ());
+    for (size_t i = 0; i < x.size (); ++i)
+    {
+        if (done[i])
+            continue;
+        auto tmp = x[i];
+        size_t j = indexes[i];
+        while (j != i)
+        {
+            assert (j < x.size ());
+            swap (tmp, x[j]);
+            done[j] = true;
+            j = indexes[j];
+        }
+        x[i] = tmp;
+        done[i] = true;
+    }
 }
 
 class timer
@@ -40,10 +40,10 @@ void call_xgboost (F f, Args... args)
 class dmatrix
 {
     public:
-    dmatrix (const std::vector<float> &features, const size_t rows, const size_t cols)
+    dmatrix (std::span<const float> features, const size_t rows, const size_t cols)
     {
         using namespace ATL24_qtrees::utils::constants;
-        call_xgboost (XGDMatrixCreateFromMat, &features[0], rows, cols, missing_data, &handle);
+        call_xgboost (XGDMatrixCreateFromMat, features.data (), rows, cols, missing_data, &handle);
     }
     DMatrixHandle *get_handle_address ()
     {
@@ -92,8 +92,9 @@ class dmatrix
 class xgbooster
 {
     public:
-    explicit xgbooster (const bool init_verbose)
+    explicit xgbooster (const bool init_verbose, const size_t init_threads = 0)
         : verbose (init_verbose)
+        , threads (init_threads)
         , initialized (false)
         , trained (false)
     {
@@ -108,7 +109,7 @@ class xgbooster
             XGBoosterFree (booster);
         }
     }
-    void train (const std::vector<float> &features,
+    void train (std::span<const float> features,
         const std::vector<uint32_t> &labels,
         const size_t rows,
         const size_t cols,
@@ -141,6 +142,9 @@ class xgbooster
             initialized = true;
         }
 
+        if (threads != 0)
+            call_xgboost (XGBoosterSetParam, booster, "nthread", to_string (threads).c_str ());
+
         // Set model parameters
         call_xgboost (XGBoosterSetParam, booster, "objective", "multi:softmax");
         call_xgboost (XGBoosterSetParam, booster, "num_class", "3");
@@ -201,25 +205,131 @@ class xgbooster
 
         call_xgboost (XGBoosterLoadModel, booster, filename.c_str ());
     }
-    std::vector<uint32_t> predict (const std::vector<float> &features,
+    // Get the indexes of the features that the model splits on, in
+    // ascending order
+    //
+    // Features that the model never splits on don't affect its
+    // predictions. If the model's features have names, their indexes
+    // aren't known, so no indexes are returned.
+    std::vector<size_t> get_used_features () const
+    {
+        using namespace std;
+
+        char const config[] = "{\"importance_type\": \"weight\"}";
+        uint64_t total;
+        const char **names = NULL;
+        uint64_t dim;
+        const uint64_t *shape;
+        const float *scores = NULL;
+        call_xgboost (XGBoosterFeatureScore, booster, config, &total, &names, &dim, &shape, &scores);
+
+        // Features without names are named "f0", "f1", ...
+        vector<size_t> used (total);
+        for (size_t i = 0; i < total; ++i)
+        {
+            const string name (names[i]);
+            if (name.size () < 2 || name[0] != 'f' || name.find_first_not_of ("0123456789", 1) != string::npos)
+            {
+                if (verbose)
+                    clog << "The model's features have names, using all of them" << endl;
+                return vector<size_t> ();
+            }
+            used[i] = stoul (name.substr (1));
+        }
+
+        sort (used.begin (), used.end ());
+        used.erase (unique (used.begin (), used.end ()), used.end ());
+
+        return used;
+    }
+    std::vector<uint32_t> predict (std::span<const float> features,
         const size_t rows,
         const size_t cols,
         const bool use_gpu = false)
     {
         using namespace std;
+
+        if (verbose)
+            clog << "Getting predictions" << endl;
+
+        set_predict_params (use_gpu);
+
+        return predict_rows (features, rows, cols);
+    }
+    // Get predictions for 'rows' rows of features
+    //
+    // The rows are created by 'write_rows (begin, end, matrix)', which
+    // writes rows [begin, end) into 'matrix'. They are created
+    // 'batch_rows' at a time, so only one batch of the feature matrix
+    // exists at a time.
+    template<typename F>
+    std::vector<uint32_t> predict (const size_t rows,
+        const size_t cols,
+        F write_rows,
+        const size_t batch_rows,
+        const bool use_gpu = false)
+    {
+        using namespace std;
         using namespace ATL24_qtrees::utils;
-        using namespace ATL24_qtrees::utils::constants;
+
+        // Check invariants
+        assert (batch_rows > 0);
 
         if (verbose)
             clog << "Getting predictions" << endl;
 
+        set_predict_params (use_gpu);
+
+        vector<uint32_t> predictions;
+        predictions.reserve (rows);
+
+        feature_matrix features (std::min (rows, batch_rows) * cols);
+
+        for (size_t begin = 0; begin < rows; begin += batch_rows)
+        {
+            const size_t end = std::min (begin + batch_rows, rows);
+            write_rows (begin, end, features.data ());
+
+            const auto p = predict_rows (span<const float> (features.data (), (end - begin) * cols),
+                end - begin,
+                cols);
+            predictions.insert (predictions.end (), p.begin (), p.end ());
+        }
+
+        return predictions;
+    }
+
+    private:
+    const bool verbose;
+    // Number of threads XGBoost uses, or 0 to use its default
+    const size_t threads;
+    bool initialized;
+    BoosterHandle booster;
+    bool trained;
+
+    // Set the booster parameters used for getting predictions
+    void set_predict_params (const bool use_gpu)
+    {
+        using namespace std;
+
+        call_xgboost (XGBoosterSetParam, booster, "device", use_gpu ? "cuda" : "cpu");
+        if (threads != 0)
+            call_xgboost (XGBoosterSetParam, booster, "nthread", to_string (threads).c_str ());
+    }
+    // Get predictions for 'rows' rows of features using the parameters
+    // that are already set
+    std::vector<uint32_t> predict_rows (std::span<const float> features,
+        const size_t rows,
+        const size_t cols)
+    {
+        using namespace std;
+        using namespace ATL24_qtrees::utils;
+        using namespace ATL24_qtrees::utils::constants;
+
         // Check invariants
         assert (!features.empty ());
         assert (features.size () == rows * cols);
 
-        // Set booster parameters
-        call_xgboost (XGBoosterSetParam, booster, "device", use_gpu ? "cuda" : "cpu");
-
         // Create the DMatrix
         dmatrix m (features, rows, cols);
 
@@ -246,12 +356,6 @@ class xgbooster
 
         return predictions;
     }
-
-    private:
-    const bool verbose;
-    bool initialized;
-    BoosterHandle booster;
-    bool trained;
 };
 
 } // namespace xgboost
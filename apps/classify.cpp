@@ -3,7 +3,7 @@
 #include "ATL24_qtrees/xgboost.h"
 #include "ATL24_qtrees/qtrees.h"
 
-const std::string usage {"classify [options] < input_filename.csv > output_filename.csv"};
+const std::string usage {"classify [options] < input_filename.{csv,bin}[.gz,.zst] > output_filename.{csv,bin}[.gz,.zst]"};
 
 int main (int argc, char **argv)
 {
@@ -33,30 +33,70 @@ int main (int argc, char **argv)
         if (args.help)
             return 0;
 
+        // Optionally compress the output
+        compression::ostream os (cout, compression::get_format (args.compression));
+
         // Read the input file
         if (args.verbose)
-            clog << "Reading CSV from stdin" << endl;
+            clog << "Reading dataframe from stdin" << endl;
 
-        const auto photons = read (cin);
+        const auto input = make_shared<const mapped_file> (STDIN_FILENO);
 
-        if (args.verbose)
+        // Classify the samples and write the results along with 'photons'
+        const auto process = [&] (const auto &photons, auto samples)
         {
-            clog << "Total photons = " << photons.rows () << endl;
-            clog << "Total dataframe columns = " << photons.headers.size () << endl;
-        }
+            processing_timer.start ();
 
-        processing_timer.start ();
+            // Get the predictions
+            feature_params fp;
+            fp.pyramid_levels = args.pyramid_levels;
+            fp.density = args.density;
+            fp.density_radius = args.density_radius;
+            samples = classify (args.verbose, std::move (samples), args.model_filename, args.chunk_size, fp);
 
-        // Convert it to the correct format
-        auto samples = convert_dataframe (photons);
+            processing_timer.stop ();
 
-        // Get the predictions
-        samples = classify (args.verbose, samples, args.model_filename);
+            // Save results
+            if (args.sidecar)
+                write_sidecar (os, samples, args.binary_output);
+            else
+                write_samples (os, photons, samples, args.binary_output);
 
-        processing_timer.stop ();
+            return photons.rows ();
+        };
+
+        size_t total_photons = 0;
+
+        if (is_csv (*input))
+        {
+            // Parse CSV input directly into samples
+            csv_rows photons;
+            auto samples = read_samples (input, photons);
+
+            if (args.verbose)
+            {
+                clog << "Total photons = " << photons.rows () << endl;
+                clog << "Total dataframe columns = " << photons.headers.size () << endl;
+            }
+
+            total_photons = process (photons, std::move (samples));
+        }
+        else
+        {
+            total_photons = columnar::visit (input, [&] (const auto &photons)
+            {
+                if (args.verbose)
+                {
+                    clog << "Total photons = " << photons.rows () << endl;
+                    clog << "Total dataframe columns = " << photons.headers.size () << endl;
+                }
+
+                // Convert it to the correct format
+                return process (photons, convert_dataframe (photons));
+            }, get_sample_columns (), true);
+        }
 
-        // Save results
-        write_samples (cout, photons, samples);
+        os.finish ();
 
         total_timer.stop ();
 
@@ -64,8 +104,8 @@ int main (int argc, char **argv)
         {
             clog << "Total elapsed time " << total_timer.elapsed_ms () / 1000.0 << " seconds" << endl;
             clog << "Elapsed processing time " << processing_timer.elapsed_ms () / 1000.0 << " seconds" << endl;
-            clog << photons.rows () / (total_timer.elapsed_ms () / 1000.0) << " photons/second total" << endl;
-            clog << photons.rows () / (processing_timer.elapsed_ms () / 1000.0) << " photons/second without I/O" << endl;
+            clog << total_photons / (total_timer.elapsed_ms () / 1000.0) << " photons/second total" << endl;
+            clog << total_photons / (processing_timer.elapsed_ms () / 1000.0) << " photons/second without I/O" << endl;
         }
 
         return 0;
@@ -0,0 +1,127 @@
+#include "precompiled.h"
+#include "classify_atl03_cmd.h"
+#include "ATL24_qtrees/atl03.h"
+#include "ATL24_qtrees/xgboost.h"
+#include "ATL24_qtrees/qtrees.h"
+
+const std::string usage {"classify_atl03 [options] --output-filename=output_filename.h5 ATL03_granule.h5"};
+
+int main (int argc, char **argv)
+{
+    using namespace std;
+    using namespace ATL24_qtrees;
+    using namespace ATL24_qtrees::utils;
+
+    try
+    {
+        // Keep track of performance
+        timer total_timer;
+        timer processing_timer;
+
+        total_timer.start ();
+
+        // Parse the args
+        const auto args = cmd::get_args (argc, argv, usage);
+
+        if (args.verbose)
+        {
+            clog << "cmd_line_parameters:" << endl;
+            clog << args;
+        }
+
+        // If you are getting help, exit without an error
+        if (args.help)
+            return 0;
+
+        if (args.output_filename.empty ())
+            throw runtime_error ("No output filename was specified");
+
+        // Read the photons for each beam
+        vector<string> beams;
+        vector<vector<utils::sample>> samples;
+
+        {
+            const atl03::detail::handle f (H5Fopen (args.input_filename.c_str (), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
+
+            for (const auto &beam : atl03::beam_names)
+            {
+                if (!atl03::has_beam (f, beam))
+                    continue;
+
+                if (args.verbose)
+                    clog << "Reading " << beam << endl;
+
+                beams.push_back (beam);
+                samples.push_back (atl03::read_beam (f, beam));
+
+                if (args.verbose)
+                    clog << samples.back ().size () << " photons read" << endl;
+            }
+        }
+
+        processing_timer.start ();
+
+        // Classify the beams concurrently, splitting the threads between
+        // them
+        const int total_threads = omp_get_max_threads ();
+        const int beam_threads = std::max (total_threads / std::max (static_cast<int> (beams.size ()), 1), 1);
+        omp_set_max_active_levels (2);
+
+        vector<string> errors (beams.size ());
+
+#pragma omp parallel for schedule(dynamic) num_threads(std::min (static_cast<int> (beams.size ()), total_threads))
+        for (size_t i = 0; i < beams.size (); ++i)
+        {
+            omp_set_num_threads (beam_threads);
+
+            try
+            {
+                if (!samples[i].empty ())
+                    samples[i] = classify (false, std::move (samples[i]), args.model_filename);
+            }
+            catch (const exception &e)
+            {
+                errors[i] = beams[i] + ": " + e.what ();
+            }
+        }
+
+        for (const auto &e : errors)
+            if (!e.empty ())
+                throw runtime_error (e);
+
+        processing_timer.stop ();
+
+        // Save results
+        size_t total_photons = 0;
+
+        {
+            if (args.verbose)
+                clog << "Writing " << args.output_filename << endl;
+
+            const atl03::detail::handle f (H5Fcreate (args.output_filename.c_str (), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT), H5Fclose);
+
+            for (size_t i = 0; i < beams.size (); ++i)
+            {
+                atl03::write_beam (f, beams[i], samples[i]);
+                total_photons += samples[i].size ();
+            }
+        }
+
+        total_timer.stop ();
+
+        if (args.verbose)
+        {
+            clog << "Total elapsed time " << total_timer.elapsed_ms () / 1000.0 << " seconds" << endl;
+            clog << "Elapsed processing time " << processing_timer.elapsed_ms () / 1000.0 << " seconds" << endl;
+            clog << total_photons / (total_timer.elapsed_ms () / 1000.0) << " photons/second total" << endl;
+            clog << total_photons / (processing_timer.elapsed_ms () / 1000.0) << " photons/second without I/O" << endl;
+        }
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
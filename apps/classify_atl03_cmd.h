@@ -0,0 +1,81 @@
+#pragma once
+
+#include "precompiled.h"
+#include "ATL24_qtrees/cmd_utils.h"
+
+namespace ATL24_qtrees
+{
+
+namespace cmd
+{
+
+struct args
+{
+    bool help = false;
+    bool verbose = false;
+    std::string model_filename;
+    std::string output_filename;
+    std::string input_filename;
+};
+
+std::ostream &operator<< (std::ostream &os, const args &args)
+{
+    os << std::boolalpha;
+    os << "help: " << args.help << std::endl;
+    os << "verbose: " << args.verbose << std::endl;
+    os << "model-filename: " << args.model_filename << std::endl;
+    os << "output-filename: " << args.output_filename << std::endl;
+    os << "input-filename: " << args.input_filename << std::endl;
+    return os;
+}
+
+args get_args (int argc, char **argv, const std::string &usage)
+{
+    args args;
+    while (1)
+    {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"help", no_argument, 0,  'h' },
+            {"verbose", no_argument, 0,  'v' },
+            {"model-filename", required_argument, 0,  'f' },
+            {"output-filename", required_argument, 0,  'o' },
+            {0,      0,           0,  0 }
+        };
+
+        int c = getopt_long(argc, argv, "hvf:o:", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+            default:
+            case 0:
+            case 'h':
+            {
+                const size_t noptions = sizeof (long_options) / sizeof (struct option);
+                ATL24_utils::cmd::print_help (std::clog, usage, noptions, long_options);
+                if (c != 'h')
+                    throw std::runtime_error ("Invalid option");
+                args.help = true;
+                return args;
+            }
+            case 'v': args.verbose = true; break;
+            case 'f': args.model_filename = std::string(optarg); break;
+            case 'o': args.output_filename = std::string(optarg); break;
+        }
+    }
+
+    // Check command line
+    if (optind + 1 < argc)
+        throw std::runtime_error ("Too many arguments on command line");
+    if (optind + 1 != argc)
+        throw std::runtime_error ("No input filename was specified");
+
+    args.input_filename = argv[optind];
+
+    return args;
+}
+
+} // namespace cmd
+
+} // namespace ATL24_qtrees
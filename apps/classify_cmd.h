@@ -2,6 +2,7 @@
 
 #include "precompiled.h"
 #include "ATL24_qtrees/cmd_utils.h"
+#include "ATL24_qtrees/qtrees.h"
 
 namespace ATL24_qtrees
 {
@@ -14,6 +15,13 @@ struct args
     bool help = false;
     bool verbose = false;
     std::string model_filename;
+    double chunk_size = default_chunk_size;
+    bool sidecar = false;
+    bool binary_output = false;
+    std::string compression;
+    size_t pyramid_levels = 0;
+    bool density = false;
+    double density_radius = utils::feature_params ().density_radius;
 };
 
 std::ostream &operator<< (std::ostream &os, const args &args)
@@ -22,6 +30,13 @@ std::ostream &operator<< (std::ostream &os, const args &args)
     os << "help: " << args.help << std::endl;
     os << "verbose: " << args.verbose << std::endl;
     os << "model-filename: " << args.model_filename << std::endl;
+    os << "chunk-size: " << args.chunk_size << std::endl;
+    os << "sidecar: " << args.sidecar << std::endl;
+    os << "binary-output: " << args.binary_output << std::endl;
+    os << "compression: " << args.compression << std::endl;
+    os << "pyramid-levels: " << args.pyramid_levels << std::endl;
+    os << "density: " << args.density << std::endl;
+    os << "density-radius: " << args.density_radius << std::endl;
     return os;
 }
 
@@ -35,10 +50,17 @@ args get_args (int argc, char **argv, const std::string &usage)
             {"help", no_argument, 0,  'h' },
             {"verbose", no_argument, 0,  'v' },
             {"model-filename", required_argument, 0,  'f' },
+            {"chunk-size", required_argument, 0,  'c' },
+            {"sidecar", no_argument, 0,  's' },
+            {"binary-output", no_argument, 0,  'b' },
+            {"compression", required_argument, 0,  'z' },
+            {"pyramid-levels", required_argument, 0,  'l' },
+            {"density", no_argument, 0,  'n' },
+            {"density-radius", required_argument, 0,  'R' },
             {0,      0,           0,  0 }
         };
 
-        int c = getopt_long(argc, argv, "hvf:", long_options, &option_index);
+        int c = getopt_long(argc, argv, "hvf:c:sbz:l:nR:", long_options, &option_index);
         if (c == -1)
             break;
 
@@ -56,6 +78,13 @@ args get_args (int argc, char **argv, const std::string &usage)
             }
             case 'v': args.verbose = true; break;
             case 'f': args.model_filename = std::string(optarg); break;
+            case 'c': args.chunk_size = atof(optarg); break;
+            case 's': args.sidecar = true; break;
+            case 'b': args.binary_output = true; break;
+            case 'z': args.compression = std::string (optarg); break;
+            case 'l': args.pyramid_levels = atol(optarg); break;
+            case 'n': args.density = true; break;
+            case 'R': args.density_radius = atof(optarg); break;
         }
     }
 
@@ -63,6 +92,9 @@ args get_args (int argc, char **argv, const std::string &usage)
     if (optind != argc)
         throw std::runtime_error ("Too many arguments on command line");
 
+    if (args.density_radius <= 0.0)
+        throw std::runtime_error ("The density radius must be positive");
+
     return args;
 }
 
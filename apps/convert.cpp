@@ -0,0 +1,62 @@
+#include "precompiled.h"
+#include "convert_cmd.h"
+#include "ATL24_qtrees/columnar.h"
+#include "ATL24_qtrees/compression.h"
+#include "ATL24_qtrees/dataframe.h"
+
+const std::string usage {"convert [options] < input_filename.{csv,bin}[.gz,.zst] > output_filename.{bin,csv}[.gz,.zst]"};
+
+int main (int argc, char **argv)
+{
+    using namespace std;
+    using namespace ATL24_qtrees;
+
+    try
+    {
+        // Parse the args
+        const auto args = cmd::get_args (argc, argv, usage);
+
+        if (args.verbose)
+        {
+            clog << "cmd_line_parameters:" << endl;
+            clog << args;
+        }
+
+        // If you are getting help, exit without an error
+        if (args.help)
+            return 0;
+
+        // Optionally compress the output
+        compression::ostream os (cout, compression::get_format (args.compression));
+
+        // Read the input file, which can be in either format
+        if (args.verbose)
+            clog << "Reading dataframe from stdin" << endl;
+
+        const auto input = make_shared<const dataframe::mapped_file> (STDIN_FILENO);
+
+        columnar::visit (input, [&] (const auto &df)
+        {
+            if (args.verbose)
+            {
+                clog << "Total rows = " << df.rows () << endl;
+                clog << "Total dataframe columns = " << df.headers.size () << endl;
+                clog << "Writing " << (args.csv ? "CSV" : "columnar") << " dataframe" << endl;
+            }
+
+            if (args.csv)
+                dataframe::write (os, df);
+            else
+                columnar::write (os, df);
+        });
+
+        os.finish ();
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
@@ -12,5 +12,6 @@
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <xgboost/c_api.h>
@@ -54,19 +54,20 @@ string print (const long cls, const confusion_matrix &cm)
 
 unordered_map<long,confusion_matrix> get_confusion_matrix_map (
     const bool verbose,
-    istream &is,
+    const shared_ptr<const dataframe::mapped_file> &f,
     const string &prediction_label,
     const long cls,
     const long ignore_cls)
 {
-    // Read the points
-    const auto df = dataframe::read (is);
-
-    if (verbose)
-        clog << "Converting dataframe" << endl;
+    // Read the points, only parsing the columns that we need
+    const auto p = columnar::visit (f, [&] (const auto &df)
+    {
+        if (verbose)
+            clog << "Converting dataframe" << endl;
 
-    // Convert it to the correct format
-    const auto p = ATL24_qtrees::utils::convert_dataframe (df);
+        // Convert it to the correct format
+        return ATL24_qtrees::utils::convert_dataframe (df);
+    }, get_sample_columns ());
 
     if (verbose)
         clog << p.size () << " points read" << endl;
@@ -148,7 +149,8 @@ unordered_map<long,confusion_matrix> get_confusion_matrix_map (
     if (filenames.empty ())
     {
         clog << "No filenames specified. Reading dataframe from stdin..." << endl;
-        return get_confusion_matrix_map (verbose, cin, prediction_label, cls, ignore_cls);
+        const auto f = make_shared<const dataframe::mapped_file> (STDIN_FILENO);
+        return get_confusion_matrix_map (verbose, f, prediction_label, cls, ignore_cls);
     }
 
     vector<unordered_map<long,confusion_matrix>> maps (filenames.size ());
@@ -179,12 +181,9 @@ unordered_map<long,confusion_matrix> get_confusion_matrix_map (
             clog << "Reading " << filenames[i] << endl;
         }
 
-        ifstream ifs (filenames[i]);
-
-        if (!ifs)
-            throw runtime_error ("Could not open file for reading");
+        const auto f = make_shared<const dataframe::mapped_file> (filenames[i]);
 
-        maps[i] = get_confusion_matrix_map (verbose, ifs, prediction_label, cls, ignore_cls);
+        maps[i] = get_confusion_matrix_map (verbose, f, prediction_label, cls, ignore_cls);
 
         if (ofs)
         {
@@ -1,5 +1,6 @@
 #include "precompiled.h"
 #include "train_cmd.h"
+#include "ATL24_qtrees/search.h"
 #include "ATL24_qtrees/xgboost.h"
 
 using namespace std;
@@ -10,18 +11,18 @@ using namespace ATL24_qtrees::xgboost;
 const string usage {"ls *.csv | train [options]"};
 
 // Train an XGBoost model given the samples in 'samples'
+//
+// If 'windows' is specified, the windows are taken from it instead of
+// being created. If 'threads' is not 0, XGBoost uses that many threads.
 template<typename T,typename U,typename V>
 xgbooster train (const T &args,
     const U &samples,
     const V &fp,
     double &accuracy,
-    bool predict)
+    bool predict,
+    const dataset_windows *windows = nullptr,
+    const size_t threads = 0)
 {
-    if (args.verbose)
-        clog << "Creating features" << endl;
-
-    const features f (samples, fp);
-
     // Create the random number generator
     mt19937_64 rng (args.random_seed);
 
@@ -48,27 +49,39 @@ xgbooster train (const T &args,
             clog << "\t" << i.second * 100.0 / sample_indexes.size ();
             clog << endl;
         }
+    }
+
+    if (args.verbose)
+        clog << "Creating features" << endl;
+
+    // Each dataset gets its own windows, and only the windows that the
+    // sampled rows need are created
+    const dataset_features f = windows == nullptr
+        ? dataset_features (samples, fp, sample_indexes)
+        : dataset_features (samples, fp, sample_indexes, *windows);
+
+    if (args.verbose)
+    {
+        clog << f.total_datasets () << " datasets" << endl;
         clog << "Creating training data" << endl;
     }
 
     // Create the raw data that gets passed to xgbooster
     const size_t rows = sample_indexes.size ();
     const size_t cols = f.features_per_sample ();
-    vector<float> features; features.reserve (rows * cols);
+    feature_matrix features (rows * cols);
     vector<uint32_t> labels; labels.reserve (rows);
     vector<uint32_t> dataset_ids; dataset_ids.reserve (rows);
 
     if (args.verbose)
         clog << "Features per sample " << f.features_per_sample () << endl;
 
+    // Get the rows
+    f.write_features (sample_indexes, features.data ());
+
     for (size_t i = 0; i < sample_indexes.size (); ++i)
     {
-        // Get a row
         const auto j = sample_indexes[i];
-        const auto row = f.get_features (j);
-
-        // Append row to matrix
-        features.insert (features.end (), row.begin (), row.end ());
 
         // Save label to vector
         const uint32_t label = remap_label (samples[j].cls);
@@ -93,7 +106,7 @@ xgbooster train (const T &args,
     assert (labels.size () == rows);
 
     // Create the booster
-    xgbooster xgb (args.verbose);
+    xgbooster xgb (args.verbose, threads);
 
     // Warm start if an input model was specified
     if (!args.input_model_filename.empty ())
@@ -136,10 +149,15 @@ xgbooster train (const T &args, const U &samples, const V &fp)
 
 // train() overload
 template<typename T,typename U,typename V>
-xgbooster train (const T &args, const U &samples, const V &fp, double &accuracy)
+xgbooster train (const T &args,
+    const U &samples,
+    const V &fp,
+    double &accuracy,
+    const dataset_windows &windows,
+    const size_t threads)
 {
     bool predict = true;
-    return train (args, samples, fp, accuracy, predict);
+    return train (args, samples, fp, accuracy, predict, &windows, threads);
 }
 
 int main (int argc, char **argv)
@@ -177,7 +195,7 @@ int main (int argc, char **argv)
             clog << fns.size () << " filenames read" << endl;
 
         // Read all of the data
-        const auto samples = read_training_samples (args.verbose, fns);
+        const auto samples = read_training_samples (args.verbose, fns, args.single_precision);
 
         if (args.search)
         {
@@ -185,22 +203,64 @@ int main (int argc, char **argv)
             for (auto window_size : {30.0, 40.0, 50.0})
                 for (auto total_quantiles : {32u, 48u, 64u, 80u, 96u})
                     for (auto adjacent_windows : {2u, 3u, 4u})
-                        fps.push_back (feature_params {window_size, total_quantiles, adjacent_windows});
+                    {
+                        feature_params fp {window_size, total_quantiles, adjacent_windows, args.pyramid_levels};
+                        fp.density = args.density;
+                        fp.density_radius = args.density_radius;
+                        fps.push_back (fp);
+                    }
 
-            // Compute accuracy for each set of parameters
-            vector<double> accuracies;
-            for (auto fp : fps)
-            {
-                // Get the trained model
-                double accuracy;
-                const auto xgb = train (args, samples, fp, accuracy);
+            const size_t jobs = std::clamp (args.search_jobs, size_t (1), fps.size ());
 
-                if (args.verbose)
-                    clog << "accuracy = " << accuracy << endl;
+            if (jobs > 1 && !args.feature_dump_filename.empty ())
+                throw runtime_error ("Features can't be dumped when running more than one search job");
 
-                accuracies.push_back (accuracy);
+            if (args.verbose)
+                clog << "Running " << jobs << " search jobs with "
+                    << search::get_job_threads (omp_get_max_threads (), jobs)
+                    << " threads each" << endl;
+
+            // Output from jobs that run at the same time would be
+            // interleaved
+            auto job_args = args;
+            job_args.verbose = args.verbose && jobs == 1;
+
+            // Write each result as soon as it is computed
+            ofstream results;
+            if (!args.search_results_filename.empty ())
+            {
+                results.open (args.search_results_filename);
+                if (!results)
+                    throw runtime_error ("Can't open search results file: " + args.search_results_filename);
+                search::write_header (results);
             }
 
+            // The windows only depend on the window size, so they are
+            // created and sorted once for each window size, and only kept
+            // while they are needed
+            const auto accuracies = search::run (fps, jobs, omp_get_max_threads (),
+                [&] (const double window_size)
+                {
+                    if (job_args.verbose)
+                        clog << "Sorting windows of size " << window_size << endl;
+
+                    return get_dataset_windows (samples, window_size);
+                },
+                [&] (const feature_params &fp, const dataset_windows &windows, const size_t threads)
+                {
+                    double accuracy;
+                    const auto xgb = train (job_args, samples, fp, accuracy, windows, threads);
+                    return accuracy;
+                },
+                [&] (const search::result &r)
+                {
+                    if (args.verbose)
+                        clog << "accuracy = " << r.accuracy << endl;
+
+                    if (results.is_open ())
+                        search::write_result (results, r);
+                });
+
             // Choose the parameters that yield the best accuracy
             assert (accuracies.size () == fps.size ());
 
@@ -238,7 +298,10 @@ int main (int argc, char **argv)
         else
         {
             // Get the trained model
-            const feature_params fp;
+            feature_params fp;
+            fp.pyramid_levels = args.pyramid_levels;
+            fp.density = args.density;
+            fp.density_radius = args.density_radius;
             const auto xgb = train (args, samples, fp);
 
             // Save it
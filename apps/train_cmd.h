@@ -2,6 +2,7 @@
 
 #include "precompiled.h"
 #include "ATL24_qtrees/cmd_utils.h"
+#include "ATL24_qtrees/utils.h"
 
 namespace ATL24_qtrees
 {
@@ -17,9 +18,15 @@ struct args
     size_t random_seed = 123;
     size_t epochs = 100;
     bool search = false;
+    size_t search_jobs = 1;
+    std::string search_results_filename;
     std::string feature_dump_filename;
     std::string input_model_filename;
     std::string output_model_filename = std::string ("./model.json");
+    bool single_precision = false;
+    size_t pyramid_levels = 0;
+    bool density = false;
+    double density_radius = utils::feature_params ().density_radius;
 };
 
 std::ostream &operator<< (std::ostream &os, const args &args)
@@ -31,9 +38,15 @@ std::ostream &operator<< (std::ostream &os, const args &args)
     os << "random-seed: " << args.random_seed << std::endl;
     os << "epochs: " << args.epochs << std::endl;
     os << "search: " << args.search << std::endl;
+    os << "search-jobs: " << args.search_jobs << std::endl;
+    os << "search-results-filename: " << args.search_results_filename << std::endl;
     os << "feature-dump-filename: " << args.feature_dump_filename << std::endl;
     os << "input-model-filename: " << args.input_model_filename << std::endl;
     os << "output-model-filename: " << args.output_model_filename << std::endl;
+    os << "single-precision: " << args.single_precision << std::endl;
+    os << "pyramid-levels: " << args.pyramid_levels << std::endl;
+    os << "density: " << args.density << std::endl;
+    os << "density-radius: " << args.density_radius << std::endl;
     return os;
 }
 
@@ -50,13 +63,19 @@ args get_args (int argc, char **argv, const std::string &usage)
             {"random-seed", required_argument, 0,  's' },
             {"epochs", required_argument, 0,  'e' },
             {"search", no_argument, 0,  'a' },
+            {"search-jobs", required_argument, 0,  'j' },
+            {"search-results-filename", required_argument, 0,  'r' },
             {"feature-dump-filename", required_argument, 0,  'd' },
             {"input-model-filename", required_argument, 0,  'i' },
             {"output-model-filename", required_argument, 0,  'o' },
+            {"single-precision", no_argument, 0,  'p' },
+            {"pyramid-levels", required_argument, 0,  'l' },
+            {"density", no_argument, 0,  'n' },
+            {"density-radius", required_argument, 0,  'R' },
             {0,      0,           0,  0 }
         };
 
-        int c = getopt_long(argc, argv, "hvb:s:e:ad:i:o:", long_options, &option_index);
+        int c = getopt_long(argc, argv, "hvb:s:e:aj:r:d:i:o:pl:nR:", long_options, &option_index);
         if (c == -1)
             break;
 
@@ -77,9 +96,15 @@ args get_args (int argc, char **argv, const std::string &usage)
             case 's': args.random_seed = atol(optarg); break;
             case 'e': args.epochs = atol(optarg); break;
             case 'a': args.search = true; break;
+            case 'j': args.search_jobs = atol(optarg); break;
+            case 'r': args.search_results_filename = std::string(optarg); break;
             case 'd': args.feature_dump_filename = std::string(optarg); break;
             case 'i': args.input_model_filename = std::string(optarg); break;
             case 'o': args.output_model_filename = std::string(optarg); break;
+            case 'p': args.single_precision = true; break;
+            case 'l': args.pyramid_levels = atol(optarg); break;
+            case 'n': args.density = true; break;
+            case 'R': args.density_radius = atof(optarg); break;
         }
     }
 
@@ -87,6 +112,9 @@ args get_args (int argc, char **argv, const std::string &usage)
     if (optind != argc)
         throw std::runtime_error ("Too many command line parameters");
 
+    if (args.density_radius <= 0.0)
+        throw std::runtime_error ("The density radius must be positive");
+
     return args;
 }
 
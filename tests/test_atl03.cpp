@@ -0,0 +1,128 @@
+#include "precompiled.h"
+#include "ATL24_qtrees/atl03.h"
+#include "ATL24_qtrees/verify.h"
+
+using namespace std;
+using namespace ATL24_qtrees;
+using namespace ATL24_qtrees::atl03;
+using namespace ATL24_qtrees::atl03::detail;
+
+// Get the name of a temporary file
+string get_temp_filename ()
+{
+    char fn[] = "/tmp/test_atl03_XXXXXX";
+    const int fd = mkstemp (fn);
+    VERIFY (fd != -1);
+    close (fd);
+    return string (fn);
+}
+
+// Write the datasets of a beam with three segments
+//
+// The second segment is empty, and the third one doesn't have a valid
+// geoid.
+void write_test_beam (const hid_t file, const string &beam, const vector<int64_t> &ph_index_beg)
+{
+    const handle g (H5Gcreate2 (file, beam.c_str (), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Gclose);
+    const handle h (H5Gcreate2 (g, "heights", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Gclose);
+    const handle l (H5Gcreate2 (g, "geolocation", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Gclose);
+    const handle c (H5Gcreate2 (g, "geophys_corr", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT), H5Gclose);
+    write_dataset (h, "h_ph", vector<float> {1, 2, 3, 4, 5, 6});
+    write_dataset (h, "dist_ph_along", vector<float> {0.5, 1, 0.25, 2, 3, 4});
+    write_dataset (l, "segment_dist_x", vector<double> {100, 120, 140, 160});
+    write_dataset (l, "segment_ph_cnt", vector<int32_t> {2, 0, 1, 3});
+    write_dataset (l, "ph_index_beg", ph_index_beg);
+    write_dataset (c, "geoid", vector<float> {10, 0, 3.4028235e38f, -1});
+}
+
+void test_read_beam ()
+{
+    const string fn = get_temp_filename ();
+
+    {
+        const handle f (H5Fcreate (fn.c_str (), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT), H5Fclose);
+        write_test_beam (f, "gt2l", {1, 0, 3, 4});
+        write_test_beam (f, "gt3r", {1, 0, 3, 5});
+    }
+
+    const handle f (H5Fopen (fn.c_str (), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
+    remove (fn.c_str ());
+
+    VERIFY (has_beam (f, "gt2l"));
+    VERIFY (!has_beam (f, "gt1l"));
+
+    // Photons are in the first and last segments
+    const auto s = read_beam (f, "gt2l");
+    VERIFY (s.size () == 5);
+    const vector<size_t> h5_indexes {0, 1, 3, 4, 5};
+    const vector<double> x {100.5, 101, 162, 163, 164};
+    const vector<double> z {-9, -8, 5, 6, 7};
+    for (size_t i = 0; i < s.size (); ++i)
+    {
+        VERIFY (s[i].h5_index == h5_indexes[i]);
+        VERIFY (s[i].x == x[i]);
+        VERIFY (s[i].z == z[i]);
+    }
+
+    // A segment that goes past the end of the photons is an error
+    bool failed = false;
+    try { read_beam (f, "gt3r"); }
+    catch (const exception &) { failed = true; }
+    VERIFY (failed);
+}
+
+void test_write_beam ()
+{
+    const string fn = get_temp_filename ();
+
+    vector<utils::sample> s (3);
+    for (size_t i = 0; i < s.size (); ++i)
+    {
+        s[i].h5_index = 10 + i;
+        s[i].prediction = 40 + i % 2;
+        s[i].surface_elevation = 1.5 * i;
+        s[i].bathy_elevation = -2.5 * i;
+    }
+
+    {
+        const handle f (H5Fcreate (fn.c_str (), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT), H5Fclose);
+        write_beam (f, "gt1r", s);
+        write_beam (f, "gt2r", vector<utils::sample> ());
+    }
+
+    const handle f (H5Fopen (fn.c_str (), H5F_ACC_RDONLY, H5P_DEFAULT), H5Fclose);
+    remove (fn.c_str ());
+
+    // The samples are the same when they are read back
+    const auto index_ph = read_dataset<int64_t> (f, "gt1r/index_ph");
+    const auto prediction = read_dataset<uint32_t> (f, "gt1r/prediction");
+    const auto sea_surface_h = read_dataset<double> (f, "gt1r/sea_surface_h");
+    const auto bathy_h = read_dataset<double> (f, "gt1r/bathy_h");
+    VERIFY (index_ph.size () == s.size ());
+    for (size_t i = 0; i < s.size (); ++i)
+    {
+        VERIFY (index_ph[i] == static_cast<int64_t> (s[i].h5_index));
+        VERIFY (prediction[i] == s[i].prediction);
+        VERIFY (sea_surface_h[i] == s[i].surface_elevation);
+        VERIFY (bathy_h[i] == s[i].bathy_elevation);
+    }
+
+    // Beams without samples have empty datasets
+    VERIFY (read_dataset<int64_t> (f, "gt2r/index_ph").empty ());
+}
+
+int main ()
+{
+    try
+    {
+        test_read_beam ();
+        test_write_beam ();
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
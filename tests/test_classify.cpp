@@ -40,6 +40,39 @@ void test_classify ()
         auto tmp = classify (verbose, p, fn);
         VERIFY (tmp == q);
     }
+
+    // It should give the same answer when it's classified in chunks
+    for (auto chunk_size : {0.0, 1.0, 10.0, 50.0})
+    {
+        auto tmp = classify (verbose, p, fn, chunk_size);
+        VERIFY (tmp == q);
+    }
+
+    // It should give the same answer when the rows of features are
+    // passed to the model in batches, including a partial last batch
+    for (auto batch_rows : {1, 7, 333})
+    {
+        auto tmp = classify (verbose, p, fn, 0.0, utils::feature_params (), batch_rows);
+        VERIFY (tmp == q);
+    }
+}
+
+void test_used_features ()
+{
+    // This model splits on every feature except for feature 79
+    xgboost::xgbooster xgb (false);
+    xgb.load_model ("models/model-20240910.json");
+    const auto used = xgb.get_used_features ();
+
+    vector<size_t> expected (161);
+    iota (expected.begin (), expected.end (), 0);
+    expected.erase (expected.begin () + 79);
+    VERIFY (used == expected);
+
+    // It doesn't skip any tables of features
+    utils::feature_params fp;
+    fp.used_features = used;
+    VERIFY (!utils::skips_feature_tables (fp));
 }
 
 int main ()
@@ -47,6 +80,7 @@ int main ()
     try
     {
         test_classify ();
+        test_used_features ();
 
         return 0;
     }
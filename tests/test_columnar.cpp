@@ -0,0 +1,155 @@
+#include "precompiled.h"
+#include "ATL24_qtrees/columnar.h"
+#include "ATL24_qtrees/verify.h"
+
+using namespace std;
+using namespace ATL24_qtrees;
+
+void test_round_trip ()
+{
+    dataframe::dataframe df;
+    df.headers = {"index_ph", "x_atc", "a_longer_column_name"};
+    df.columns.resize (df.headers.size ());
+    for (size_t i = 0; i < 1001; ++i)
+    {
+        df.columns[0].push_back (i);
+        df.columns[1].push_back (i * 0.7);
+        df.columns[2].push_back (-1.0 / (i + 1));
+    }
+
+    char fn[] = "/tmp/test_columnar_XXXXXX";
+    const int fd = mkstemp (fn);
+    VERIFY (fd != -1);
+    close (fd);
+
+    {
+        ofstream ofs (fn);
+        columnar::write (ofs, df);
+    }
+
+    const auto f = make_shared<const dataframe::mapped_file> (string (fn));
+    remove (fn);
+    VERIFY (columnar::is_columnar (*f));
+
+    const auto m = columnar::read (f);
+    VERIFY (m.is_valid ());
+    VERIFY (m.headers == df.headers);
+    VERIFY (m.rows () == df.rows ());
+    for (size_t i = 0; i < df.columns.size (); ++i)
+    {
+        // Columns are aligned
+        const auto &c = m.columns[i].get<double> ();
+        VERIFY (reinterpret_cast<uintptr_t> (c.data ()) % columnar::alignment == 0);
+        VERIFY (equal (c.begin (), c.end (), df.columns[i].begin ()));
+    }
+    VERIFY (m["x_atc"][10] == 7.0);
+
+    // visit () uses columnar input in place
+    const size_t rows = columnar::visit (f, [] (const auto &x) { return x.rows (); });
+    VERIFY (rows == df.rows ());
+}
+
+void test_typed ()
+{
+    using dataframe::column_type;
+
+    dataframe::typed_dataframe df;
+    df.headers = {"i", "u", "f", "d"};
+    df.columns = {
+        dataframe::column (vector<int64_t> {1, -2, 1'000'000'000'000}),
+        dataframe::column (vector<uint8_t> {40, 41, 255}),
+        dataframe::column (vector<float> {0.5f, -1.25f, 3.0f}),
+        dataframe::column (vector<double> {0.1, 0.2, 0.3})};
+
+    stringstream ss;
+    columnar::write (ss, df);
+    const string s = ss.str ();
+    const auto f = make_shared<const dataframe::mapped_file> (vector<char> (s.begin (), s.end ()));
+    const auto m = columnar::read (f);
+
+    // Types are preserved
+    VERIFY (m.columns[0].type () == column_type::int64);
+    VERIFY (m.columns[1].type () == column_type::uint8);
+    VERIFY (m.columns[2].type () == column_type::float32);
+    VERIFY (m.columns[3].type () == column_type::float64);
+    VERIFY (m["i"].get<int64_t> ()[2] == 1'000'000'000'000);
+    VERIFY (m["u"].get<uint8_t> ()[2] == 255);
+    VERIFY (m["f"].get<float> ()[1] == -1.25f);
+    VERIFY (m["d"][2] == 0.3);
+}
+
+void test_truncated ()
+{
+    dataframe::dataframe df;
+    df.headers = {"a"};
+    df.columns = {{1.0, 2.0, 3.0}};
+
+    stringstream ss;
+    columnar::write (ss, df);
+    string s = ss.str ();
+    s.resize (s.size () - 1);
+
+    char fn[] = "/tmp/test_columnar_XXXXXX";
+    const int fd = mkstemp (fn);
+    VERIFY (fd != -1);
+    VERIFY (write (fd, s.data (), s.size ()) == static_cast<ssize_t> (s.size ()));
+    close (fd);
+
+    bool failed = false;
+    try
+    {
+        columnar::read (string (fn));
+    }
+    catch (const exception &)
+    {
+        failed = true;
+    }
+    remove (fn);
+    VERIFY (failed);
+}
+
+void test_compressed ()
+{
+    dataframe::dataframe df;
+    df.headers = {"a", "b"};
+    df.columns = {{1.0, 2.0, 3.0}, {4.0, 5.0, 6.0}};
+
+    for (auto fmt : {compression::format::gzip, compression::format::zstd})
+    {
+        stringstream ss;
+        compression::ostream os (ss, fmt);
+        columnar::write (os, df);
+        os.finish ();
+
+        const string s = ss.str ();
+        const auto f = make_shared<const dataframe::mapped_file> (vector<char> (s.begin (), s.end ()));
+        VERIFY (!columnar::is_columnar (*f));
+
+        // visit () decompresses columnar input
+        const auto b = columnar::visit (f, [] (const auto &x)
+        {
+            VERIFY (x.headers.size () == 2);
+            const auto &c = x["b"].template get<double> ();
+            return vector<double> (c.begin (), c.end ());
+        });
+        VERIFY (b == df.columns[1]);
+    }
+}
+
+int main ()
+{
+    try
+    {
+        test_round_trip ();
+        test_typed ();
+        test_truncated ();
+        test_compressed ();
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
@@ -0,0 +1,333 @@
+#include "precompiled.h"
+#include "ATL24_qtrees/dataframe.h"
+#include "ATL24_qtrees/verify.h"
+
+using namespace std;
+using namespace ATL24_qtrees::dataframe;
+
+const string csv {
+    "index_ph,x_atc,geoid_corr_h\r\n"
+    "0,100.5,-1.25\r\n"
+    "\r\n"
+    "1,+101.5, 2e-3\r\n"
+    "2,abc,3\r\n"
+    "3,103.5\n"
+    "4,1e999,-5"};
+
+void check_dataframe (const dataframe &df)
+{
+    VERIFY (df.is_valid ());
+    VERIFY (df.headers.size () == 3);
+    VERIFY (df.headers[0] == "index_ph");
+    VERIFY (df.headers[2] == "geoid_corr_h");
+    VERIFY (df.rows () == 5);
+    VERIFY (df["index_ph"][4] == 4);
+    VERIFY (df["x_atc"][0] == 100.5);
+    VERIFY (df["x_atc"][1] == 101.5);
+    VERIFY (df["geoid_corr_h"][0] == -1.25);
+    VERIFY (df["geoid_corr_h"][1] == 2e-3);
+    // Bad fields are zero and don't affect the following fields
+    VERIFY (df["x_atc"][2] == 0.0);
+    VERIFY (df["geoid_corr_h"][2] == 3.0);
+    // Missing fields are zero
+    VERIFY (df["geoid_corr_h"][3] == 0.0);
+    // Out of range values saturate
+    VERIFY (std::isinf (df["x_atc"][4]));
+    VERIFY (df["geoid_corr_h"][4] == -5.0);
+}
+
+void test_read_stream ()
+{
+    stringstream ss (csv);
+    check_dataframe (read (ss));
+
+    // Empty streams give empty dataframes
+    stringstream empty;
+    VERIFY (read (empty).headers.empty ());
+}
+
+void test_read_file ()
+{
+    char fn[] = "/tmp/test_dataframe_XXXXXX";
+    const int fd = mkstemp (fn);
+    VERIFY (fd != -1);
+    close (fd);
+
+    {
+        ofstream ofs (fn);
+        ofs << csv;
+    }
+
+    const auto df = read (string (fn));
+    remove (fn);
+    check_dataframe (df);
+}
+
+void test_read_columns ()
+{
+    stringstream ss (csv);
+    const auto df = read (ss, {"geoid_corr_h", "index_ph", "missing"});
+
+    // Columns are in file order, and missing columns are ignored
+    VERIFY (df.is_valid ());
+    VERIFY (df.headers.size () == 2);
+    VERIFY (df.headers[0] == "index_ph");
+    VERIFY (df.headers[1] == "geoid_corr_h");
+    VERIFY (!df.has_column ("x_atc"));
+    VERIFY (df.rows () == 5);
+    VERIFY (df["index_ph"][3] == 3);
+    VERIFY (df["geoid_corr_h"][0] == -1.25);
+    VERIFY (df["geoid_corr_h"][2] == 3.0);
+    VERIFY (df["geoid_corr_h"][3] == 0.0);
+}
+
+void test_read_typed ()
+{
+    const auto df = read_typed (csv.data (), csv.data () + csv.size (), {
+        {"index_ph", column_type::int64},
+        {"geoid_corr_h", column_type::float32}});
+
+    VERIFY (df.is_valid ());
+    VERIFY (df.headers.size () == 2);
+    VERIFY (df.rows () == 5);
+    VERIFY (df.columns[0].type () == column_type::int64);
+    VERIFY (df.columns[1].type () == column_type::float32);
+    VERIFY (df["index_ph"].get<int64_t> ()[4] == 4);
+    VERIFY (df["geoid_corr_h"].get<float> ()[0] == -1.25f);
+
+    // Other columns are float64
+    const auto all = read_typed (csv.data (), csv.data () + csv.size (), {{"index_ph", column_type::uint8}}, true);
+    VERIFY (all.headers.size () == 3);
+    VERIFY (all.columns[0].type () == column_type::uint8);
+    VERIFY (all.columns[1].type () == column_type::float64);
+    VERIFY (all["x_atc"][0] == 100.5);
+
+    // Typed columns are written like float64 columns
+    stringstream typed;
+    write (typed, all);
+    stringstream untyped;
+    write (untyped, read (csv.data (), csv.data () + csv.size ()));
+    VERIFY (typed.str () == untyped.str ());
+
+    // Appending requires matching types
+    auto tmp = all;
+    tmp.append (all);
+    VERIFY (tmp.rows () == 10);
+    VERIFY (tmp["index_ph"].get<uint8_t> ()[9] == 4);
+    bool failed = false;
+    try { tmp.append (read_typed (csv.data (), csv.data () + csv.size (), {}, true)); }
+    catch (const exception &) { failed = true; }
+    VERIFY (failed);
+
+    // Integer columns can hold any value in their range
+    const string ints ("a,b\n255.5,-9.2e18\n-0.5,9.2e18\n");
+    const auto i = read_typed (ints.data (), ints.data () + ints.size (), {
+        {"a", column_type::uint8},
+        {"b", column_type::int64}});
+    VERIFY (i["a"].get<uint8_t> ()[0] == 255);
+    VERIFY (i["a"].get<uint8_t> ()[1] == 0);
+    VERIFY (i["b"].get<int64_t> ()[0] == -9'200'000'000'000'000'000);
+
+    // But not values outside of it, or values that aren't finite
+    for (const string bad : {"256", "-1", "nan", "inf", "-inf", "1e999"})
+    {
+        const string tmp_csv = string ("a,b\n1,2\n") + bad + ",3\n";
+        bool bad_failed = false;
+        try { read_typed (tmp_csv.data (), tmp_csv.data () + tmp_csv.size (), {{"a", column_type::uint8}}); }
+        catch (const exception &) { bad_failed = true; }
+        VERIFY (bad_failed);
+    }
+    const string big ("a\n1e19\n");
+    failed = false;
+    try { read_typed (big.data (), big.data () + big.size (), {{"a", column_type::int64}}); }
+    catch (const exception &) { failed = true; }
+    VERIFY (failed);
+
+    // Bad values are also caught when the rows are parsed in parallel,
+    // in several chunks
+    stringstream ss;
+    ss << "a\n";
+    for (size_t j = 0; j < 500'000; ++j)
+        ss << (j == 400'000 ? "nan" : "1.00000000") << "\n";
+    const string many = ss.str ();
+    failed = false;
+    try { read_typed (many.data (), many.data () + many.size (), {{"a", column_type::int64}}); }
+    catch (const exception &) { failed = true; }
+    VERIFY (failed);
+}
+
+void test_column_handles ()
+{
+    dataframe df;
+    df.headers = {"a", "b", "a"};
+    df.columns = {{1.0}, {2.0}, {3.0}};
+
+    // Duplicate names find the first column
+    VERIFY (df.has_column ("b"));
+    VERIFY (!df.has_column ("c"));
+    VERIFY (df.get_handle ("a").index == 0);
+    VERIFY (df.get_handle ("b").index == 1);
+    VERIFY (df["a"][0] == 1.0);
+
+    bool failed = false;
+    try { df.get_handle ("c"); }
+    catch (const exception &) { failed = true; }
+    VERIFY (failed);
+
+    // Handles stay valid as rows are added
+    const auto b = df.get_handle ("b");
+    const auto other = df;
+    df.add_row (other, 0);
+    df.append (other);
+    df.append (other);
+    VERIFY (df.rows () == 4);
+    VERIFY (df[b][3] == 2.0);
+    df[b][3] = 4.0;
+    VERIFY (df["b"][3] == 4.0);
+
+    // New columns are indexed
+    df.columns.push_back (vector<double> (df.rows (), 5.0));
+    df.headers.push_back ("c");
+    VERIFY (df["c"][3] == 5.0);
+
+    // So are copies
+    const auto tmp = df;
+    VERIFY (tmp.headers == df.headers);
+    VERIFY (tmp.get_handle ("c").index == 3);
+}
+
+void test_read_parallel ()
+{
+    // Big enough to be split into several chunks
+    const size_t n = 500'000;
+    stringstream ss;
+    ss << "a,b\n";
+    for (size_t i = 0; i < n; ++i)
+    {
+        ss << i << "," << i << ".5\n";
+        // Throw in some empty lines
+        if (i % 1000 == 0)
+            ss << "\n";
+    }
+
+    const auto df = read (ss);
+    VERIFY (df.rows () == n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        VERIFY (df.columns[0][i] == i);
+        VERIFY (df.columns[1][i] == i + 0.5);
+    }
+}
+
+// Compress 's'
+string compress (const string &s, const ATL24_qtrees::compression::format fmt)
+{
+    stringstream ss;
+    ATL24_qtrees::compression::ostream os (ss, fmt);
+    os << s;
+    os.finish ();
+    return ss.str ();
+}
+
+void test_read_compressed ()
+{
+    using ATL24_qtrees::compression::format;
+
+    // Big enough to span several decompressed blocks
+    const size_t n = 500'000;
+    stringstream ss;
+    ss << "a,b\n";
+    for (size_t i = 0; i < n; ++i)
+        ss << i << "," << i << ".5\n";
+
+    for (auto fmt : {format::gzip, format::zstd})
+    {
+        // Small
+        stringstream small (compress (csv, fmt));
+        check_dataframe (read (small));
+
+        // Large
+        stringstream large (compress (ss.str (), fmt));
+        const auto df = read (large, {"b"});
+        VERIFY (df.headers.size () == 1);
+        VERIFY (df.rows () == n);
+        for (size_t i = 0; i < n; ++i)
+            VERIFY (df.columns[0][i] == i + 0.5);
+
+        // Truncated
+        const auto tmp = compress (csv, fmt);
+        bool failed = false;
+        try { read (tmp.data (), tmp.data () + tmp.size () / 2); }
+        catch (...) { failed = true; }
+        VERIFY (failed);
+    }
+
+    // Concatenated gzip files
+    const auto gz = compress ("a,b\n1,2\n", format::gzip) + compress ("3,4\n", format::gzip);
+    const auto df = read (gz.data (), gz.data () + gz.size ());
+    VERIFY (df.rows () == 2);
+    VERIFY (df["b"][1] == 4.0);
+}
+
+void test_write ()
+{
+    // Some values that are hard to format
+    const vector<double> values {
+        0.0,
+        -0.0,
+        1.0 / 3.0,
+        -123.456,
+        1e-300,
+        6.02214076e23,
+        numeric_limits<double>::max (),
+        numeric_limits<double>::lowest (),
+        numeric_limits<double>::infinity (),
+        -numeric_limits<double>::infinity (),
+        numeric_limits<double>::quiet_NaN ()};
+
+    // Enough rows to get split into blocks
+    dataframe df;
+    df.headers = {"a", "b"};
+    df.columns.resize (2);
+    for (size_t i = 0; i < 50'000; ++i)
+    {
+        df.columns[0].push_back (values[i % values.size ()]);
+        df.columns[1].push_back (i * 0.1);
+    }
+
+    // It should match ostream formatting
+    for (auto precision : {0, 3, 16})
+    {
+        stringstream expected;
+        expected << "a,b" << endl;
+        expected << fixed << setprecision (precision);
+        for (size_t i = 0; i < df.rows (); ++i)
+            expected << df.columns[0][i] << "," << df.columns[1][i] << endl;
+
+        stringstream ss;
+        write (ss, df, precision);
+        VERIFY (ss.str () == expected.str ());
+    }
+}
+
+int main ()
+{
+    try
+    {
+        test_read_stream ();
+        test_read_file ();
+        test_read_columns ();
+        test_read_typed ();
+        test_column_handles ();
+        test_read_parallel ();
+        test_read_compressed ();
+        test_write ();
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
@@ -0,0 +1,201 @@
+#include "precompiled.h"
+#include "ATL24_qtrees/search.h"
+#include "ATL24_qtrees/verify.h"
+
+using namespace std;
+using namespace ATL24_qtrees;
+using namespace ATL24_qtrees::search;
+using namespace ATL24_qtrees::utils;
+
+vector<feature_params> get_fps ()
+{
+    vector<feature_params> fps;
+    for (auto window_size : {30.0, 40.0, 50.0})
+        for (auto total_quantiles : {32u, 48u})
+            fps.push_back (feature_params {window_size, total_quantiles, 2});
+    return fps;
+}
+
+void test_job_threads ()
+{
+    VERIFY (get_job_threads (8, 1) == 8);
+    VERIFY (get_job_threads (8, 3) == 2);
+    VERIFY (get_job_threads (2, 4) == 1);
+    VERIFY (get_job_threads (8, 0) == 8);
+}
+
+void test_results_table ()
+{
+    stringstream ss;
+    write_header (ss);
+    feature_params fp {40.0, 32, 2};
+    write_result (ss, result {3, 0.5, fp, 1.25});
+    VERIFY (ss.str () ==
+        "index\taccuracy\twindow_size\ttotal_quantiles\tadjacent_windows\tseconds\n"
+        "3\t0.5\t40\t32\t2\t1.25\n");
+}
+
+void test_run ()
+{
+    const auto fps = get_fps ();
+
+    for (size_t jobs : {1, 2, 4})
+    {
+        // Windows that still exist
+        vector<weak_ptr<double>> windows;
+        size_t most_windows = 0;
+        mutex m;
+
+        vector<size_t> reported;
+        const size_t total_threads = 8;
+
+        const auto accuracies = run (fps, jobs, total_threads,
+            [&] (const double window_size)
+            {
+                lock_guard<mutex> lock (m);
+                const auto w = make_shared<double> (window_size);
+                windows.push_back (w);
+                most_windows = std::max (most_windows, static_cast<size_t> (count_if (windows.begin (), windows.end (),
+                    [] (const auto &i) { return !i.expired (); })));
+                return w;
+            },
+            [&] (const feature_params &fp, const shared_ptr<double> &w, const size_t threads)
+            {
+                // The jobs get the right windows and their share of the
+                // threads
+                VERIFY (*w == fp.window_size);
+                VERIFY (threads == get_job_threads (total_threads, jobs));
+                VERIFY (static_cast<size_t> (omp_get_max_threads ()) == threads);
+                return fp.window_size + fp.total_quantiles;
+            },
+            [&] (const result &r)
+            {
+                reported.push_back (r.index);
+                VERIFY (r.accuracy == fps[r.index].window_size + fps[r.index].total_quantiles);
+            });
+
+        // Each result is reported once
+        VERIFY (accuracies.size () == fps.size ());
+        sort (reported.begin (), reported.end ());
+        for (size_t i = 0; i < fps.size (); ++i)
+        {
+            VERIFY (accuracies[i] == fps[i].window_size + fps[i].total_quantiles);
+            VERIFY (reported[i] == i);
+        }
+
+        // The windows for each window size are created once, and they
+        // are all gone at the end
+        VERIFY (windows.size () == 3);
+        for (const auto &i : windows)
+            VERIFY (i.expired ());
+
+        // When jobs run one at a time, only one window size is kept at a
+        // time
+        if (jobs == 1)
+            VERIFY (most_windows == 1);
+    }
+}
+
+void test_run_exception ()
+{
+    const auto fps = get_fps ();
+
+    // The first exception that a job throws gets rethrown
+    for (size_t jobs : {1, 3})
+    {
+        vector<weak_ptr<double>> windows;
+        mutex m;
+        size_t evaluated = 0;
+        bool failed = false;
+        try
+        {
+            run (fps, jobs, 4,
+                [&] (const double window_size)
+                {
+                    lock_guard<mutex> lock (m);
+                    const auto w = make_shared<double> (window_size);
+                    windows.push_back (w);
+                    return w;
+                },
+                [&] (const feature_params &fp, const shared_ptr<double> &, const size_t)
+                {
+#pragma omp atomic
+                    ++evaluated;
+                    if (fp.window_size == 40.0)
+                        throw runtime_error ("bad window size");
+                    return 1.0;
+                },
+                [] (const result &) { });
+        }
+        catch (const exception &e)
+        {
+            failed = (string (e.what ()) == "bad window size");
+        }
+        VERIFY (failed);
+
+        for (const auto &i : windows)
+            VERIFY (i.expired ());
+
+        // The parameters after the one that failed are skipped
+        if (jobs == 1)
+            VERIFY (evaluated == 3);
+    }
+
+    // A value is released when a job that uses it throws
+    {
+        weak_ptr<double> window;
+        const auto create = [&] (const double window_size)
+        {
+            const auto w = make_shared<double> (window_size);
+            window = w;
+            return w;
+        };
+        shared_values<double,shared_ptr<double>,decltype (create)> values (create, {{40.0, 1}});
+        bool failed = false;
+        try
+        {
+            decltype (values)::lease w (values, 40.0);
+            VERIFY (*w.get () == 40.0);
+            throw runtime_error ("bad window size");
+        }
+        catch (const exception &)
+        {
+            failed = true;
+        }
+        VERIFY (failed);
+        VERIFY (window.expired ());
+    }
+
+    // So do exceptions from reporting the results
+    bool failed = false;
+    try
+    {
+        run (fps, 2, 4,
+            [] (const double window_size) { return window_size; },
+            [] (const feature_params &, const double, const size_t) { return 1.0; },
+            [] (const result &r) { if (r.index == 1) throw runtime_error ("bad report"); });
+    }
+    catch (const exception &e)
+    {
+        failed = (string (e.what ()) == "bad report");
+    }
+    VERIFY (failed);
+}
+
+int main ()
+{
+    try
+    {
+        test_job_threads ();
+        test_results_table ();
+        test_run ();
+        test_run_exception ();
+
+        return 0;
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what () << endl;
+        return -1;
+    }
+}
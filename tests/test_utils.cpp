@@ -28,11 +28,639 @@ void test_get_window_indexes ()
     VERIFY (w[n - 1] == 1);
 }
 
+void test_window_elevations ()
+{
+    // Create some samples in random windows
+    const size_t n = 10'000;
+    const size_t first_window = 3;
+    const size_t total_windows = 50;
+    mt19937_64 rng (123);
+    uniform_int_distribution<size_t> d (first_window, first_window + total_windows - 1);
+    vector<ATL24_qtrees::utils::sample> s (n);
+    vector<size_t> window_indexes (n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        s[i].z = i;
+        window_indexes[i] = d (rng);
+    }
+
+    auto e = get_window_elevations (s, window_indexes, first_window, total_windows);
+    VERIFY (e.size () == total_windows);
+    VERIFY (e.values.size () == n);
+
+    // Each window has its samples' elevations, in order
+    vector<vector<double>> expected (total_windows);
+    for (size_t i = 0; i < n; ++i)
+        expected[window_indexes[i] - first_window].push_back (s[i].z);
+    for (size_t i = 0; i < total_windows; ++i)
+    {
+        const auto w = e[i];
+        VERIFY (vector<double> (w.begin (), w.end ()) == expected[i]);
+    }
+
+    // Windows can be empty
+    e = get_window_elevations (s, window_indexes, 0, first_window + total_windows);
+    VERIFY (e[0].empty ());
+    VERIFY (e[first_window].size () == expected[0].size ());
+}
+
+void test_sparse_windows ()
+{
+    using namespace ATL24_qtrees::utils::constants;
+
+    // Create samples on either side of a long gap, with an empty window
+    // between two occupied ones
+    vector<ATL24_qtrees::utils::sample> p;
+    mt19937_64 rng (123);
+    uniform_real_distribution<double> d (-10.0, 10.0);
+    for (const auto x0 : {0.0, 80.0, 1e6, 1e6 + 40.0})
+        for (size_t i = 0; i < 100; ++i)
+            p.push_back ({.x = x0 + i * 0.3, .z = d (rng)});
+
+    const feature_params fp;
+    const features f (p, fp);
+
+    // Only occupied windows are stored
+    VERIFY (f.occupied_windows () == 4);
+
+    // Only the windows needed by the selected samples are created
+    const features g (p, fp, vector<size_t> {0, 99});
+    VERIFY (g.occupied_windows () == 2);
+    VERIFY (g.get_features (0) == f.get_features (0));
+    VERIFY (g.get_features (99) == f.get_features (99));
+
+    // Get the features from all of the windows on the track, with the
+    // default parameters and with others
+    for (const auto &fp2 : {fp, feature_params {40.0, 16, 3}})
+    {
+        const features f2 (p, fp2);
+        const auto window_indexes = get_window_indexes (p, fp2.window_size);
+        const auto windows = get_windows (p, fp2, window_indexes);
+        VERIFY (windows.size () > 25'000);
+
+        for (size_t n = 0; n < p.size (); ++n)
+        {
+            vector<float> expected {static_cast<float> (p[n].z)};
+            const auto append = [&] (const size_t i)
+            {
+                if (i < windows.size ())
+                    expected.insert (expected.end (), windows[i].quantiles.begin (), windows[i].quantiles.end ());
+                else
+                    expected.insert (expected.end (), fp2.total_quantiles, missing_data);
+            };
+            const size_t i = window_indexes[n];
+            append (i);
+            for (size_t j = 0; j < fp2.adjacent_windows; ++j)
+            {
+                append (i + (j + 1));
+                append (i - (j + 1));
+            }
+            VERIFY (f2.get_features (n) == expected);
+        }
+    }
+}
+
+void test_dataset_features ()
+{
+    // Create two datasets that cover the same part of the track
+    vector<ATL24_qtrees::utils::sample> p;
+    mt19937_64 rng (123);
+    uniform_real_distribution<double> d (-10.0, 10.0);
+    for (size_t id = 0; id < 2; ++id)
+        for (size_t i = 0; i < 1'000; ++i)
+            p.push_back ({.dataset_id = id, .x = 5.0 * id + i * 0.5, .z = d (rng)});
+
+    const feature_params fp;
+    const dataset_features f (p, fp);
+    VERIFY (f.total_datasets () == 2);
+    VERIFY (f.size () == p.size ());
+
+    // Each dataset's features only depend on its own samples
+    const span<const ATL24_qtrees::utils::sample> a (p.data (), 1'000);
+    const span<const ATL24_qtrees::utils::sample> b (p.data () + 1'000, 1'000);
+    const features fa (a, fp);
+    const features fb (b, fp);
+    for (size_t i = 0; i < 1'000; ++i)
+    {
+        VERIFY (f.get_features (i) == fa.get_features (i));
+        VERIFY (f.get_features (i + 1'000) == fb.get_features (i));
+    }
+
+    // Only the windows needed by the selected samples are created
+    const vector<size_t> selected {10, 1'500};
+    const dataset_features h (p, fp, selected);
+    for (const auto i : selected)
+        VERIFY (h.get_features (i) == f.get_features (i));
+
+    // Windows that were already sorted give the same features
+    const auto w = get_dataset_windows (p, fp.window_size);
+    for (const size_t nq : {16, 32, 48})
+        for (const size_t na : {1, 2, 3})
+        {
+            const feature_params fp2 {fp.window_size, nq, na};
+            const dataset_features g (p, fp2, selected);
+            const dataset_features k (p, fp2, selected, w);
+            for (const auto i : selected)
+                VERIFY (k.get_features (i) == g.get_features (i));
+        }
+
+    // Datasets must be contiguous
+    p.push_back (p[0]);
+    bool failed = false;
+    try { dataset_features g (p, fp); }
+    catch (...) { failed = true; }
+    VERIFY (failed);
+}
+
+// Get 'n' random points with some gaps along the track
+vector<ATL24_qtrees::utils::sample> get_track_with_gaps (const size_t n)
+{
+    mt19937 rng (12345);
+    uniform_real_distribution<double> dx (0.0, 2000.0);
+    uniform_real_distribution<double> dz (-60.0, 20.0);
+
+    vector<ATL24_qtrees::utils::sample> p (n);
+    for (auto &i : p)
+    {
+        do { i.x = dx (rng); } while (i.x > 500.0 && i.x < 700.0);
+        i.z = dz (rng);
+    }
+    return p;
+}
+
+void test_pyramid_features ()
+{
+    const auto p = get_track_with_gaps (5'000);
+
+    feature_params fp;
+    const features f (p, fp);
+    fp.pyramid_levels = 2;
+    const features g (p, fp);
+
+    const size_t nq = fp.total_quantiles;
+    VERIFY (g.features_per_sample () == f.features_per_sample () + 2 * nq);
+
+    // Get the elevations in each window on each level of the pyramid
+    const auto window_indexes = get_window_indexes (p, fp.window_size);
+    vector<map<size_t,vector<double>>> levels (fp.pyramid_levels);
+    for (size_t i = 0; i < p.size (); ++i)
+        for (size_t l = 0; l < fp.pyramid_levels; ++l)
+            levels[l][window_indexes[i] >> (l + 1)].push_back (p[i].z);
+
+    ATL24_qtrees::utils::detail::sort_buffers b;
+    for (size_t n = 0; n < p.size (); n += 7)
+    {
+        const auto a = f.get_features (n);
+        const auto c = g.get_features (n);
+
+        // The other features are the same
+        VERIFY (equal (a.begin (), a.end (), c.begin ()));
+
+        // Each level has the quantiles of all of the photons in its
+        // window
+        for (size_t l = 0; l < fp.pyramid_levels; ++l)
+        {
+            auto e = levels[l][window_indexes[n] >> (l + 1)];
+            const auto w = create_window (e, fp, b);
+            const vector<float> expected (w.quantiles.begin (), w.quantiles.end ());
+            const auto first = c.begin () + a.size () + l * nq;
+            VERIFY (equal (expected.begin (), expected.end (), first));
+        }
+    }
+
+    // Only creating the windows for some samples gives the same features
+    const vector<size_t> selected {0, 100, 4'999};
+    const features h (p, fp, selected);
+    for (const auto i : selected)
+        VERIFY (h.get_features (i) == g.get_features (i));
+}
+
+void test_densities ()
+{
+    // Random points
+    mt19937 rng (12345);
+    uniform_real_distribution<double> dx (0.0, 200.0);
+    uniform_real_distribution<double> dz (-10.0, 10.0);
+
+    vector<ATL24_qtrees::utils::sample> p (2'000);
+    for (auto &i : p)
+    {
+        i.x = dx (rng);
+        i.z = dz (rng);
+    }
+
+    // Count the neighbors the slow way
+    const double radius = 1.5;
+    vector<size_t> expected (p.size ());
+    for (size_t i = 0; i < p.size (); ++i)
+        for (size_t j = 0; j < p.size (); ++j)
+            if (i != j)
+                expected[i] += (p[i].x - p[j].x) * (p[i].x - p[j].x) + (p[i].z - p[j].z) * (p[i].z - p[j].z) <= radius * radius;
+
+    VERIFY (get_densities (p, radius) == expected);
+
+    // Only count some of them
+    const vector<size_t> selected {5, 1'000};
+    const auto d = get_densities (p, radius, &selected);
+    VERIFY (d[5] == expected[5]);
+    VERIFY (d[1'000] == expected[1'000]);
+    VERIFY (d[6] == 0);
+
+    // The photon features have the densities
+    feature_params fp;
+    fp.density_radius = radius;
+    const auto pf = get_photon_features (p, fp);
+    VERIFY (pf.size () == p.size ());
+    VERIFY (pf[5].density == expected[5]);
+    VERIFY (pf[5].elevation == p[5].z);
+
+    // The density is the last feature
+    fp.density = true;
+    const features f (p, fp);
+    VERIFY (f.features_per_sample () == 1 + 5 * fp.total_quantiles + 1);
+    for (size_t i = 0; i < p.size (); i += 11)
+        VERIFY (f.get_features (i).back () == expected[i]);
+
+    // A long gap with a small radius only stores the occupied cells
+    vector<ATL24_qtrees::utils::sample> q (p.begin (), p.begin () + 1'000);
+    for (size_t i = 0; i < q.size (); ++i)
+    {
+        q[i].x = i < q.size () / 2 ? q[i].x / 100.0 : 400'000.0 + q[i].x / 100.0;
+        q[i].z /= 100.0;
+    }
+    const double small_radius = 0.01;
+    vector<size_t> q_expected (q.size ());
+    for (size_t i = 0; i < q.size (); ++i)
+        for (size_t j = 0; j < q.size (); ++j)
+            if (i != j)
+                q_expected[i] += (q[i].x - q[j].x) * (q[i].x - q[j].x) + (q[i].z - q[j].z) * (q[i].z - q[j].z) <= small_radius * small_radius;
+
+    VERIFY (get_densities (q, small_radius) == q_expected);
+    VERIFY (accumulate (q_expected.begin (), q_expected.end (), size_t (0)) > 0);
+}
+
+void test_used_features ()
+{
+    using namespace ATL24_qtrees::utils::constants;
+
+    // Random points
+    mt19937 rng (12345);
+    uniform_real_distribution<double> dx (0.0, 1000.0);
+    uniform_real_distribution<double> dz (-60.0, 20.0);
+
+    vector<ATL24_qtrees::utils::sample> p (5'000);
+    for (auto &i : p)
+    {
+        i.x = dx (rng);
+        i.z = dz (rng);
+    }
+
+    feature_params fp;
+    fp.pyramid_levels = 2;
+    fp.density = true;
+    const features f (p, fp);
+    const size_t cols = f.features_per_sample ();
+
+    // Columns where each table's features start and end
+    const size_t window_columns = 1 + 5 * fp.total_quantiles;
+    const size_t pyramid_columns = window_columns + 2 * fp.total_quantiles;
+
+    // Only use some of the elevation, window, adjacent window, pyramid,
+    // and density features
+    for (const auto &used : {
+        vector<size_t> {0, 3, 40, 140, cols - 1},
+        vector<size_t> {0},
+        vector<size_t> {cols - 1},
+        vector<size_t> {window_columns + 7}})
+    {
+        auto fp2 = fp;
+        fp2.used_features = used;
+        const features g (p, fp2);
+        VERIFY (g.features_per_sample () == cols);
+        VERIFY (g.uses_default_row_writer ());
+
+        // The features from tables that aren't used are missing
+        const auto t = get_feature_tables (fp2);
+        const auto computed = [&] (const size_t j)
+        {
+            if (j == 0)
+                return true;
+            if (j < window_columns)
+                return t.windows;
+            if (j < pyramid_columns)
+                return t.pyramid;
+            return t.density;
+        };
+
+        for (size_t i = 0; i < p.size (); i += 7)
+        {
+            const auto a = f.get_features (i);
+            const auto b = g.get_features (i);
+            for (size_t j = 0; j < cols; ++j)
+            {
+                if (binary_search (used.begin (), used.end (), j))
+                    VERIFY (computed (j));
+
+                if (computed (j))
+                    VERIFY (b[j] == a[j]);
+                else
+                    VERIFY (b[j] == missing_data);
+            }
+        }
+    }
+
+    // These skip the pyramid, the windows, and the density
+    VERIFY (skips_feature_tables (feature_params {40.0, 32, 2, 2, true, 1.0, {0, 3, cols - 1}}));
+    VERIFY (skips_feature_tables (feature_params {40.0, 32, 2, 2, true, 1.0, {window_columns}}));
+    VERIFY (skips_feature_tables (feature_params {40.0, 32, 2, 2, true, 1.0, {1, window_columns}}));
+
+    // Using a feature from every table doesn't skip any, so all of them
+    // are computed with the default row writer
+    vector<size_t> all (cols);
+    iota (all.begin (), all.end (), 0);
+    for (const auto &used : {all, vector<size_t> {1, window_columns, cols - 1}})
+    {
+        auto fp2 = fp;
+        fp2.used_features = used;
+        VERIFY (!skips_feature_tables (fp2));
+
+        const features g (p, fp2);
+        VERIFY (g.uses_default_row_writer ());
+        for (size_t i = 0; i < p.size (); i += 7)
+            VERIFY (g.get_features (i) == f.get_features (i));
+    }
+}
+
+void test_chunked_features ()
+{
+    auto p = get_track_with_gaps (10'000);
+    sort (p.begin (), p.end (), [] (const auto &a, const auto &b) { return a.x < b.x; });
+
+    // Check the windows that are added to each chunk with and without the
+    // pyramid and density, including density neighbors that are farther
+    // away than the adjacent windows
+    feature_params pyramid;
+    pyramid.pyramid_levels = 2;
+    pyramid.density = true;
+    feature_params wide;
+    wide.pyramid_levels = 3;
+    wide.density = true;
+    wide.density_radius = 100.0;
+
+    for (const auto &fp : {feature_params (), pyramid, wide})
+    {
+        // Get features for the whole track
+        const features f (p, fp);
+        const auto window_indexes = get_window_indexes (p, fp.window_size);
+        const size_t total_windows = window_indexes.back () + 1;
+
+        // Get features for each chunk, including the windows that its
+        // features are computed from
+        for (const size_t chunk_windows : {1, 3, 5})
+        {
+            size_t total = 0;
+            for (size_t first = 0; first < total_windows; first += chunk_windows)
+            {
+                const size_t last = min (first + chunk_windows, total_windows);
+                const auto [first_adjacent, last_adjacent] = get_feature_windows (fp, first, last, total_windows);
+                VERIFY (first_adjacent <= first);
+                VERIFY (last <= last_adjacent);
+                VERIFY (last_adjacent <= total_windows);
+
+                const auto get_index = [&] (const size_t w)
+                {
+                    return lower_bound (window_indexes.begin (), window_indexes.end (), w) - window_indexes.begin ();
+                };
+                const size_t begin = get_index (first);
+                const size_t end = get_index (last);
+                const size_t adjacent_begin = get_index (first_adjacent);
+                const size_t adjacent_end = get_index (last_adjacent);
+
+                const span<const ATL24_qtrees::utils::sample> chunk (p.data () + adjacent_begin, adjacent_end - adjacent_begin);
+                const features g (chunk,
+                    fp,
+                    vector<size_t> (window_indexes.begin () + adjacent_begin, window_indexes.begin () + adjacent_end),
+                    first_adjacent,
+                    last_adjacent,
+                    total_windows);
+
+                // They should be the same
+                for (size_t i = begin; i < end; ++i, ++total)
+                    VERIFY (g.get_features (i - adjacent_begin) == f.get_features (i));
+
+                // Whether they are written in bulk or not
+                const size_t cols = f.features_per_sample ();
+                feature_matrix m ((end - begin) * cols);
+                g.write_features (begin - adjacent_begin, end - adjacent_begin, m.data ());
+                VERIFY (reinterpret_cast<uintptr_t> (m.data ()) % 64 == 0);
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const auto row = f.get_features (i);
+                    VERIFY (equal (row.begin (), row.end (), m.begin () + (i - begin) * cols));
+                }
+            }
+
+            VERIFY (total == p.size ());
+        }
+    }
+
+    // The pyramid adds the rest of the windows under the chunk's windows
+    // at the top level, and density adds the windows its neighbors can
+    // be in
+    VERIFY (get_feature_windows (feature_params (), 10, 13, 100) == make_pair (size_t (8), size_t (15)));
+    VERIFY (get_feature_windows (pyramid, 10, 13, 100) == make_pair (size_t (8), size_t (16)));
+    VERIFY (get_feature_windows (wide, 10, 13, 100) == make_pair (size_t (6), size_t (17)));
+    VERIFY (get_feature_windows (wide, 1, 2, 10) == make_pair (size_t (0), size_t (8)));
+    VERIFY (get_feature_windows (wide, 9, 10, 10) == make_pair (size_t (5), size_t (10)));
+
+    // Write the features for selected samples
+    const features f (p, feature_params ());
+    const vector<size_t> indexes {9'999, 0, 5'000, 5'000};
+    feature_matrix m (indexes.size () * f.features_per_sample ());
+    f.write_features (indexes, m.data ());
+    for (size_t i = 0; i < indexes.size (); ++i)
+    {
+        const auto row = f.get_features (indexes[i]);
+        VERIFY (equal (row.begin (), row.end (), m.begin () + i * f.features_per_sample ()));
+    }
+}
+
+void test_permute_in_place ()
+{
+    mt19937 rng (123);
+    vector<size_t> indexes (1000);
+    iota (indexes.begin (), indexes.end (), 0);
+    shuffle (indexes.begin (), indexes.end (), rng);
+
+    vector<int> x (indexes.size ());
+    iota (x.begin (), x.end (), 100);
+    const auto y (x);
+
+    gather_in_place (x, indexes);
+    for (size_t i = 0; i < x.size (); ++i)
+        VERIFY (x[i] == y[indexes[i]]);
+
+    scatter_in_place (x, indexes);
+    VERIFY (x == y);
+}
+
+// The quantiles computed by sorting and binning one photon at a time
+vector<double> reference_quantiles (vector<double> x, const size_t nq)
+{
+    vector<double> q (nq);
+    if (x.size () < nq)
+        return q;
+    sort (x.begin (), x.end ());
+    vector<size_t> total (nq);
+    const double photons_per_quantile = static_cast<double> (x.size ()) / nq;
+    for (size_t i = 0; i < x.size (); ++i)
+    {
+        const size_t index = i / photons_per_quantile;
+        q[index] += x[i];
+        ++total[index];
+    }
+    for (size_t i = 0; i < q.size (); ++i)
+        q[i] /= total[i];
+    return q;
+}
+
+void test_quantiles ()
+{
+    mt19937 rng (123);
+    uniform_real_distribution<double> d (-30.0, 10.0);
+    detail::sort_buffers b;
+
+    // Small, medium, and large windows, with and without ties
+    for (auto n : {0, 5, 31, 32, 33, 64, 65, 100, 1000, 1023, 1024, 5000})
+    {
+        for (auto nq : {32u, 48u, 96u})
+        {
+            vector<double> x (n);
+            for (auto &i : x)
+                i = (n % 2) ? std::round (d (rng)) : d (rng);
+            if (n > 3)
+                x[1] = -0.0;
+
+            feature_params fp;
+            fp.total_quantiles = nq;
+            auto y = x;
+            const auto q = get_quantiles (y, fp, b);
+
+            // The results are exactly the same
+            VERIFY (q == reference_quantiles (x, nq));
+
+            // And the input is sorted in place
+            if (x.size () >= nq)
+                VERIFY (is_sorted (y.begin (), y.end ()));
+        }
+    }
+
+    // Out of range elevations are removed
+    vector<double> e {-100.0, 1.0, 30.0, 2.0};
+    feature_params fp;
+    fp.total_quantiles = 2;
+    const auto w = create_window (e, fp, b);
+    VERIFY (e.size () == 2);
+    VERIFY (w.quantiles[0] == 1.0);
+    VERIFY (w.quantiles[1] == 2.0);
+}
+
+void test_read_samples ()
+{
+    const string csv {
+        "extra,geoid_corr_h,index_ph,x_atc,manual_label\n"
+        "1.5,-2.25,10,100.5,40\n"
+        "\n"
+        "2.5,3.0,11,101.5\n"
+        "3.5,bad,12,102.5,41\n"};
+
+    const auto f = make_shared<const ATL24_qtrees::dataframe::mapped_file> (vector<char> (csv.begin (), csv.end ()));
+    VERIFY (is_csv (*f));
+
+    // Parsing directly into samples is the same as going through a
+    // dataframe
+    csv_rows rows;
+    auto samples = read_samples (f, rows);
+    const auto df = ATL24_qtrees::dataframe::read (csv.data (), csv.data () + csv.size ());
+    VERIFY (rows.rows () == 3);
+    VERIFY (rows.headers == df.headers);
+    VERIFY (samples == convert_dataframe (df));
+    VERIFY (samples[1].cls == 0);
+    VERIFY (samples[2].h5_index == 12);
+
+    // So is writing them
+    for (size_t i = 0; i < samples.size (); ++i)
+    {
+        samples[i].prediction = 40 + i;
+        samples[i].surface_elevation = i * 0.5;
+        samples[i].bathy_elevation = -1.0 * i;
+    }
+    stringstream a;
+    write_samples (a, rows, samples);
+    stringstream b;
+    write_samples (b, df, samples);
+    VERIFY (a.str () == b.str ());
+}
+
+void test_write_sidecar ()
+{
+    using ATL24_qtrees::dataframe::column_type;
+
+    vector<ATL24_qtrees::utils::sample> samples (5);
+    for (size_t i = 0; i < samples.size (); ++i)
+    {
+        samples[i].h5_index = 1'000'000'000 + 7 * i;
+        samples[i].prediction = i % 2 ? 40 : 41;
+        samples[i].surface_elevation = i * 0.5;
+        samples[i].bathy_elevation = -1.0 * i;
+    }
+
+    // Both CSV and binary sidecars can be read back
+    for (const bool binary : {false, true})
+    {
+        stringstream ss;
+        write_sidecar (ss, samples, binary);
+        const string s = ss.str ();
+        const auto f = make_shared<const ATL24_qtrees::dataframe::mapped_file> (vector<char> (s.begin (), s.end ()));
+        VERIFY (ATL24_qtrees::columnar::is_columnar (*f) == binary);
+
+        ATL24_qtrees::columnar::visit (f, [&] (const auto &df)
+        {
+            VERIFY (df.is_valid ());
+            VERIFY (df.rows () == samples.size ());
+            VERIFY (df.headers[0] == pi_name);
+            VERIFY (df.headers[1] == "prediction");
+            if (binary)
+            {
+                VERIFY (df[pi_name].type () == column_type::int64);
+                VERIFY (df["prediction"].type () == column_type::uint8);
+            }
+            for (size_t i = 0; i < samples.size (); ++i)
+            {
+                VERIFY (df[pi_name][i] == samples[i].h5_index);
+                VERIFY (df["prediction"][i] == samples[i].prediction);
+                VERIFY (df["bathy_h"][i] == samples[i].bathy_elevation);
+            }
+        });
+    }
+}
+
 int main ()
 {
     try
     {
         test_get_window_indexes ();
+        test_window_elevations ();
+        test_sparse_windows ();
+        test_dataset_features ();
+        test_pyramid_features ();
+        test_densities ();
+        test_used_features ();
+        test_chunked_features ();
+        test_permute_in_place ();
+        test_quantiles ();
+        test_read_samples ();
+        test_write_sidecar ();
 
         return 0;
     }